@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "queue/readerwriterqueue.h"
+#include "Socket.hpp"
+
+// Accepts connections on several SO_REUSEPORT listeners, one thread each, so the kernel
+// spreads an accept storm across cores instead of queueing it behind a single accept().
+// Each listener drains its backlog with accept4 until EAGAIN and hands the fds to the
+// game thread through its own queue, nothing is shared between listeners.
+class Acceptor {
+
+	struct Shard {
+		int fd;
+		std::thread thread;
+		ReaderWriterQueue<int> accepted; // listener thread -> tryTake
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards;
+	std::atomic<bool> running;
+	std::atomic<Socket::Listener*> listener;
+	size_t next = 0; // shard tryTake looks at first, spreads consumption evenly
+
+public:
+	// listeners == 0 picks one per core
+	Acceptor(const std::string& port, unsigned listeners = 0) : running(true), listener(nullptr) {
+		if (listeners == 0) {
+			listeners = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		for (unsigned i = 0; i < listeners; i++) {
+			std::unique_ptr<Shard> shard(new Shard());
+			shard->fd = Socket::initServer(port, SOMAXCONN, true);
+
+			int flags = fcntl(shard->fd, F_GETFL, 0);
+			if (flags == -1 || fcntl(shard->fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+				perror("fcntl");
+			}
+
+			shards.push_back(std::move(shard));
+		}
+
+		// start only once every listener is bound, so none of them misses its share
+		for (auto& shard : shards) {
+			Shard* s = shard.get();
+			s->thread = std::thread([this, s]() { run(*s); });
+		}
+	}
+
+	~Acceptor() {
+		running = false;
+		for (auto& shard : shards) {
+			shard->thread.join();
+			::close(shard->fd);
+
+			int fd;
+			while (shard->accepted.try_dequeue(fd)) {
+				::close(fd);
+			}
+		}
+	}
+
+	Acceptor(const Acceptor&) = delete;
+	Acceptor& operator=(const Acceptor&) = delete;
+
+	size_t listeners() const {
+		return shards.size();
+	}
+
+	// told whenever connections are waiting for tryTake, from the listener threads
+	void setListener(Socket::Listener* l) {
+		listener = l;
+	}
+
+	// an accepted (nonblocking) fd if there is one, only call from one thread
+	bool tryTake(int& fd) {
+		for (size_t i = 0; i < shards.size(); i++) {
+			Shard& shard = *shards[(next + i) % shards.size()];
+			if (shard.accepted.try_dequeue(fd)) {
+				next = (next + i + 1) % shards.size();
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	void run(Shard& shard) {
+		struct pollfd pfd;
+		pfd.fd = shard.fd;
+		pfd.events = POLLIN;
+
+		while (running) {
+			// wake up now and then to notice shutdown
+			int ready = poll(&pfd, 1, 100);
+			if (ready <= 0) {
+				if (ready == -1 && errno != EINTR) {
+					perror("poll");
+				}
+				continue;
+			}
+
+			bool took = false;
+			while (true) {
+				int fd = accept4(shard.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd != -1) {
+					shard.accepted.enqueue(fd);
+					took = true;
+					continue;
+				}
+
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					perror("accept4");
+					if (errno == EMFILE || errno == ENFILE) {
+						// out of fds, back off instead of spinning on a full backlog
+						std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					}
+				}
+				break;
+			}
+
+			// once per drained backlog, not per connection
+			Socket::Listener* l = listener.load();
+			if (took && l) {
+				l->onSocketActivity();
+			}
+		}
+	}
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+// Appends values of any width up to 32 bits to a byte vector, least significant bit first.
+// Bits collect in a 64 bit scratch word and go out a byte at a time, flush() pads the last one.
+class BitWriter {
+public:
+	explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+	~BitWriter() {
+		flush();
+	}
+
+	void write(uint32_t value, unsigned bits) {
+		scratch |= uint64_t(value & mask(bits)) << used;
+		used += bits;
+		while (used >= 8) {
+			out.push_back(uint8_t(scratch));
+			scratch >>= 8;
+			used -= 8;
+		}
+	}
+
+	void writeBool(bool value) {
+		write(value, 1);
+	}
+
+	// two's complement, value must fit in bits
+	void writeSigned(int32_t value, unsigned bits) {
+		write(uint32_t(value), bits);
+	}
+
+	void flush() {
+		if (used > 0) {
+			out.push_back(uint8_t(scratch));
+			scratch = 0;
+			used = 0;
+		}
+	}
+
+	// bits written so far, including what's still in scratch
+	size_t bitsWritten() const {
+		return out.size() * 8 + used;
+	}
+
+	static uint32_t mask(unsigned bits) {
+		return bits >= 32 ? 0xffffffff : (1u << bits) - 1;
+	}
+
+private:
+	std::vector<uint8_t>& out;
+	uint64_t scratch = 0;
+	unsigned used = 0;
+};
+
+// Reads back what BitWriter wrote. Reading past the end gives zeros and sets overrun().
+class BitReader {
+public:
+	BitReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+	uint32_t read(unsigned bits) {
+		while (used < bits) {
+			uint64_t byte = 0;
+			if (at < size) {
+				byte = data[at];
+			} else {
+				overran = true;
+			}
+			at++;
+			scratch |= byte << used;
+			used += 8;
+		}
+		uint32_t value = uint32_t(scratch) & BitWriter::mask(bits);
+		scratch >>= bits;
+		used -= bits;
+		return value;
+	}
+
+	bool readBool() {
+		return read(1);
+	}
+
+	int32_t readSigned(unsigned bits) {
+		uint32_t value = read(bits);
+		if (bits < 32 && value & (1u << (bits - 1))) {
+			value |= ~BitWriter::mask(bits); // sign extend
+		}
+		return int32_t(value);
+	}
+
+	bool overrun() const {
+		return overran;
+	}
+
+private:
+	const uint8_t* data;
+	size_t size;
+	size_t at = 0;
+	uint64_t scratch = 0;
+	unsigned used = 0;
+	bool overran = false;
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Everything that comes into the rooms, recorded as it is handled so replay.cpp can push it
+// back through the same Room code with no sockets and no clock. Each room keeps its own
+// records in the order things happened to it and writes them out once per run, so rooms on
+// different workers only meet on the file lock once a tick, not once a frame.
+//
+// The file is "OOOC", u32 version, then records, little endian:
+//   u8 kind, u32 room, then for
+//   JOIN   u8 client
+//   LEAVE  u8 client
+//   FRAME  u8 client, u16 length, payload
+//   RUN    u16 steps
+// A run's RUN record comes after the leaves and frames it handled, so a frame arrived in
+// the tick of the next RUN for its room. Joins happen between runs, outside of any.
+class Capture {
+public:
+	enum Kind : uint8_t {
+		JOIN,
+		LEAVE,
+		FRAME,
+		RUN,
+	};
+
+	enum : uint32_t {
+		MAGIC = 0x434f4f4f, // "OOOC"
+		VERSION = 1,
+	};
+
+	struct Record {
+		Kind kind;
+		uint32_t room;
+		uint8_t client; // JOIN, LEAVE and FRAME
+		uint16_t steps; // RUN
+		std::vector<uint8_t> payload; // FRAME
+	};
+
+	// record every room to path from now on, before any room runs
+	static bool open(const std::string& path) {
+		FILE* f = fopen(path.c_str(), "wb");
+		if (!f) {
+			perror("capture: fopen");
+			return false;
+		}
+
+		uint8_t header[8];
+		put32(header, MAGIC);
+		put32(header + 4, VERSION);
+		if (fwrite(header, sizeof header, 1, f) != 1) {
+			perror("capture: fwrite");
+			fclose(f);
+			return false;
+		}
+
+		file() = f;
+		return true;
+	}
+
+	static bool enabled() {
+		return file() != nullptr;
+	}
+
+	// push what the rooms wrote to the kernel, the lobby does it every pass
+	static void flush() {
+		if (!enabled()) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex());
+		fflush(file());
+	}
+
+	// one room's records until its run is over
+	class Buffer {
+	public:
+		void join(uint32_t room, uint8_t client) {
+			begin(JOIN, room);
+			bytes.push_back(client);
+		}
+
+		void leave(uint32_t room, uint8_t client) {
+			begin(LEAVE, room);
+			bytes.push_back(client);
+		}
+
+		void frame(uint32_t room, uint8_t client, const std::vector<uint8_t>& payload) {
+			if (payload.size() > 0xffff) {
+				return; // bigger than any frame a client sends
+			}
+			begin(FRAME, room);
+			bytes.push_back(client);
+			bytes.push_back(uint8_t(payload.size()));
+			bytes.push_back(uint8_t(payload.size() >> 8));
+			bytes.insert(bytes.end(), payload.begin(), payload.end());
+		}
+
+		// closes the run and writes it all to the file
+		void run(uint32_t room, unsigned steps) {
+			begin(RUN, room);
+			bytes.push_back(uint8_t(steps));
+			bytes.push_back(uint8_t(steps >> 8));
+
+			std::lock_guard<std::mutex> lock(mutex());
+			if (fwrite(bytes.data(), bytes.size(), 1, file()) != 1) {
+				perror("capture: fwrite");
+			}
+			bytes.clear();
+		}
+
+	private:
+		std::vector<uint8_t> bytes;
+
+		void begin(Kind kind, uint32_t room) {
+			bytes.push_back(kind);
+			bytes.push_back(uint8_t(room));
+			bytes.push_back(uint8_t(room >> 8));
+			bytes.push_back(uint8_t(room >> 16));
+			bytes.push_back(uint8_t(room >> 24));
+		}
+	};
+
+	// reads a capture back, record by record
+	class Reader {
+	public:
+		~Reader() {
+			if (f) {
+				fclose(f);
+			}
+		}
+
+		bool open(const std::string& path) {
+			f = fopen(path.c_str(), "rb");
+			if (!f) {
+				perror("capture: fopen");
+				return false;
+			}
+
+			uint8_t header[8];
+			if (fread(header, sizeof header, 1, f) != 1 || get32(header) != MAGIC || get32(header + 4) != VERSION) {
+				fprintf(stderr, "capture: %s is not a version %u capture\n", path.c_str(), VERSION);
+				return false;
+			}
+			return true;
+		}
+
+		// false at the end, or at a record cut short by the server going down mid write
+		bool next(Record& record) {
+			uint8_t head[5];
+			if (fread(head, sizeof head, 1, f) != 1 || head[0] > RUN) {
+				return false;
+			}
+			record.kind = Kind(head[0]);
+			record.room = get32(head + 1);
+			record.payload.clear();
+
+			uint8_t b[3];
+			switch (record.kind) {
+				case JOIN:
+				case LEAVE: {
+					if (fread(b, 1, 1, f) != 1) {
+						return false;
+					}
+					record.client = b[0];
+					return true;
+				}
+
+				case FRAME: {
+					if (fread(b, 3, 1, f) != 1) {
+						return false;
+					}
+					record.client = b[0];
+					record.payload.resize(b[1] | b[2] << 8);
+					return record.payload.empty() || fread(record.payload.data(), record.payload.size(), 1, f) == 1;
+				}
+
+				case RUN: {
+					if (fread(b, 2, 1, f) != 1) {
+						return false;
+					}
+					record.steps = b[0] | b[1] << 8;
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		FILE* f = nullptr;
+	};
+
+private:
+	static FILE*& file() {
+		static FILE* instance = nullptr;
+		return instance;
+	}
+
+	static std::mutex& mutex() {
+		static std::mutex instance;
+		return instance;
+	}
+
+	static void put32(uint8_t* out, uint32_t v) {
+		out[0] = v;
+		out[1] = v >> 8;
+		out[2] = v >> 16;
+		out[3] = v >> 24;
+	}
+
+	static uint32_t get32(const uint8_t* in) {
+		return in[0] | in[1] << 8 | in[2] << 16 | uint32_t(in[3]) << 24;
+	}
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <iostream>
+#include <thread>
+
+#ifdef DEBUG
+	#define DEBUG_PRINT(x) std::cout << std::this_thread::get_id() << ":" << __FILE__ << ":" << __LINE__ << ": " << x << std::endl
+	#define IF_DEBUG(x) x
+#else
+	#define DEBUG_PRINT(x)
+	#define IF_DEBUG(x)
+#endif
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX__) || defined(__SSE__)
+	#include <immintrin.h>
+#endif
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "glm/gtc/type_aligned.hpp"
+
+// Refers to an entity in an EntityStore, stays valid only as long as the entity lives.
+// The generation changes every time a slot is reused, so a stale handle never finds the new tenant.
+struct EntityHandle {
+	uint32_t slot = INVALID;
+	uint32_t generation = 0;
+
+	enum : uint32_t { INVALID = 0xffffffff };
+
+	bool valid() const {
+		return slot != INVALID;
+	}
+};
+
+// Every entity in a room, stored as parallel arrays (structure of arrays) so a pass over
+// one field walks contiguous memory. Live entities are packed at the front (dense index),
+// removal swaps the last one into the hole. Handles go through a slot table, and the slot
+// number doubles as the entity's id on the wire.
+class EntityStore {
+public:
+	enum Flag : uint8_t {
+		FROZEN = 1 << 0, // integrate() leaves it where it is
+		CAPTURED = 1 << 1, // a robber a cop got to
+	};
+
+	explicit EntityStore(size_t maxEntities) : maxEntities(maxEntities) {}
+
+	size_t size() const {
+		return position.size();
+	}
+
+	// an invalid handle when the store is full
+	EntityHandle create() {
+		EntityHandle handle;
+		if (size() >= maxEntities) {
+			return handle;
+		}
+
+		if (freeSlots.empty()) {
+			freeSlots.push_back(slots.size());
+			slots.push_back(Slot());
+		}
+		handle.slot = freeSlots.back();
+		freeSlots.pop_back();
+
+		Slot& slot = slots[handle.slot];
+		slot.dense = size();
+		handle.generation = slot.generation;
+
+		position.push_back(glm::aligned_vec4(0.0f));
+		velocity.push_back(glm::aligned_vec4(0.0f));
+		orientation.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+		role.push_back(0);
+		flags.push_back(0);
+		denseSlot.push_back(handle.slot);
+
+		return handle;
+	}
+
+	void destroy(EntityHandle handle) {
+		if (!alive(handle)) {
+			return;
+		}
+
+		// move the last entity into the hole
+		uint32_t hole = slots[handle.slot].dense;
+		uint32_t last = size() - 1;
+		if (hole != last) {
+			position[hole] = position[last];
+			velocity[hole] = velocity[last];
+			orientation[hole] = orientation[last];
+			role[hole] = role[last];
+			flags[hole] = flags[last];
+			denseSlot[hole] = denseSlot[last];
+			slots[denseSlot[hole]].dense = hole;
+		}
+
+		position.pop_back();
+		velocity.pop_back();
+		orientation.pop_back();
+		role.pop_back();
+		flags.pop_back();
+		denseSlot.pop_back();
+
+		slots[handle.slot].generation++;
+		slots[handle.slot].dense = Slot::DEAD;
+		freeSlots.push_back(handle.slot);
+	}
+
+	bool alive(EntityHandle handle) const {
+		return handle.slot < slots.size()
+			&& slots[handle.slot].generation == handle.generation
+			&& slots[handle.slot].dense != Slot::DEAD;
+	}
+
+	// dense index of a live entity, for indexing the arrays below
+	uint32_t index(EntityHandle handle) const {
+		return slots[handle.slot].dense;
+	}
+
+	// slot (wire id) and generation of the entity at dense index i
+	uint32_t slotOf(size_t i) const {
+		return denseSlot[i];
+	}
+
+	uint32_t generationOf(size_t i) const {
+		return slots[denseSlot[i]].generation;
+	}
+
+	// position += velocity * dt for everything not FROZEN
+	void integrate(float dt) {
+		size_t n = size();
+		if (n == 0) {
+			return;
+		}
+
+		size_t i = 0;
+
+#if defined(__AVX__) || defined(__SSE__)
+		float* p = &position[0].x;
+		const float* v = &velocity[0].x;
+#endif
+
+#if defined(__AVX__)
+		// two entities per register
+		__m256 step = _mm256_set1_ps(dt);
+		for (; i + 2 <= n; i += 2) {
+			if (flags[i] & FROZEN || flags[i + 1] & FROZEN) {
+				integrateOne(i, dt);
+				integrateOne(i + 1, dt);
+				continue;
+			}
+			__m256 pos = _mm256_loadu_ps(p + 4 * i);
+			__m256 vel = _mm256_loadu_ps(v + 4 * i);
+			_mm256_storeu_ps(p + 4 * i, _mm256_add_ps(pos, _mm256_mul_ps(vel, step)));
+		}
+#elif defined(__SSE__)
+		// one entity per register, aligned_vec4 keeps every one on a 16 byte boundary
+		__m128 step = _mm_set1_ps(dt);
+		for (; i < n; i++) {
+			if (flags[i] & FROZEN) {
+				continue;
+			}
+			__m128 pos = _mm_load_ps(p + 4 * i);
+			__m128 vel = _mm_load_ps(v + 4 * i);
+			_mm_store_ps(p + 4 * i, _mm_add_ps(pos, _mm_mul_ps(vel, step)));
+		}
+#endif
+
+		for (; i < n; i++) {
+			integrateOne(i, dt);
+		}
+	}
+
+	// w is padding, always 0 so vector math on the whole vec4 stays correct
+	std::vector<glm::aligned_vec4> position;
+	std::vector<glm::aligned_vec4> velocity;
+	std::vector<glm::quat> orientation;
+	std::vector<uint8_t> role;
+	std::vector<uint8_t> flags;
+
+private:
+	void integrateOne(size_t i, float dt) {
+		if (!(flags[i] & FROZEN)) {
+			position[i] += velocity[i] * dt;
+		}
+	}
+
+	struct Slot {
+		enum : uint32_t { DEAD = 0xffffffff };
+
+		uint32_t dense = DEAD;
+		uint32_t generation = 0;
+	};
+
+	size_t maxEntities;
+	std::vector<Slot> slots; // by handle slot
+	std::vector<uint32_t> freeSlots;
+	std::vector<uint32_t> denseSlot; // by dense index
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include <cstdint>
+
+// Fixed timestep bookkeeping for something run at deadlines (see Scheduler).
+// Time between runs goes into an accumulator and comes out as whole simulation steps,
+// and every simRate / netRate steps one of them is marked for a network send, so the
+// tick rate can go up without the snapshot rate following it.
+class FixedStep {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// steps run at most per call to advance(), a run that far behind drops the rest
+	enum : unsigned { MAX_CATCH_UP = 4 };
+
+	struct Stats {
+		uint64_t steps = 0;
+		uint64_t netSteps = 0;
+		uint64_t missed = 0; // steps dropped instead of caught up
+		uint64_t overruns = 0; // runs that finished after the next one was due
+	};
+
+	FixedStep(unsigned simRate, unsigned netRate)
+		: step(std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / simRate),
+			dtSeconds(1.0f / simRate),
+			stepsPerNet(simRate / netRate ? simRate / netRate : 1) {}
+
+	float dt() const {
+		return dtSeconds;
+	}
+
+	Clock::duration period() const {
+		return step;
+	}
+
+	// start counting from deadline, nothing before it gets simulated
+	void reset(Clock::time_point deadline) {
+		last = deadline;
+		accumulator = Clock::duration::zero();
+	}
+
+	// how many steps to simulate for a run due at deadline
+	unsigned advance(Clock::time_point deadline) {
+		accumulator += deadline - last;
+		last = deadline;
+
+		unsigned steps = accumulator / step;
+		accumulator -= steps * step;
+
+		if (steps > MAX_CATCH_UP) {
+			count(stats.missed, totals().missed, steps - MAX_CATCH_UP);
+			steps = MAX_CATCH_UP;
+		}
+		return steps;
+	}
+
+	// call once per simulated step, true when this step should also send a snapshot
+	bool stepNet() {
+		count(stats.steps, totals().steps, 1);
+		if (++sinceNet < stepsPerNet) {
+			return false;
+		}
+		sinceNet = 0;
+		count(stats.netSteps, totals().netSteps, 1);
+		return true;
+	}
+
+	// deadline of the run after the one due at deadline, given the current run finished at now
+	Clock::time_point next(Clock::time_point deadline, Clock::time_point now) {
+		Clock::time_point next = deadline + step;
+		if (now > next) {
+			count(stats.overruns, totals().overruns, 1);
+		}
+
+		// more than a step behind, run right away and let advance() sort out what was lost
+		if (next + step < now) {
+			next = now;
+		}
+		return next;
+	}
+
+	const Stats& local() const {
+		return stats;
+	}
+
+	// summed over every FixedStep in the process
+	static Stats total() {
+		Totals& t = totals();
+		Stats s;
+		s.steps = t.steps.load(std::memory_order_relaxed);
+		s.netSteps = t.netSteps.load(std::memory_order_relaxed);
+		s.missed = t.missed.load(std::memory_order_relaxed);
+		s.overruns = t.overruns.load(std::memory_order_relaxed);
+		return s;
+	}
+
+private:
+	struct Totals {
+		std::atomic<uint64_t> steps;
+		std::atomic<uint64_t> netSteps;
+		std::atomic<uint64_t> missed;
+		std::atomic<uint64_t> overruns;
+
+		Totals() : steps(0), netSteps(0), missed(0), overruns(0) {}
+	};
+
+	static Totals& totals() {
+		static Totals instance;
+		return instance;
+	}
+
+	static void count(uint64_t& mine, std::atomic<uint64_t>& all, uint64_t n) {
+		mine += n;
+		all.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	Clock::duration step;
+	float dtSeconds;
+	unsigned stepsPerNet;
+
+	Clock::time_point last;
+	Clock::duration accumulator = Clock::duration::zero();
+	unsigned sinceNet = 0;
+	Stats stats;
+};
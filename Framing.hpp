@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "RecvBuffer.hpp"
+
+// How a connection writes each frame's length in front of its payload.
+// Connections start out LEGACY and switch to VARINT when the client asks for it
+// with a FRAMING_VARINT message (see Socket).
+enum class Framing {
+	LEGACY, // one byte, payloads of 1-255 bytes
+	VARINT, // LEB128, 7 bits per byte, low bits first
+};
+
+struct FrameHeader {
+	enum : uint32_t {
+		MAX_SIZE = 4, // bytes, enough for anything up to 2^28
+		MAX_PAYLOAD = 1 << 20,
+		LEGACY_MAX_PAYLOAD = 0xff,
+	};
+
+	// write the header for a payload of length bytes into out (MAX_SIZE bytes)
+	// returns the header size, or 0 if length can't be framed this way
+	static size_t encode(Framing framing, uint32_t length, uint8_t* out) {
+		if (length == 0 || length > MAX_PAYLOAD) {
+			return 0;
+		}
+
+		if (length < 0x80) {
+			out[0] = length;
+			return 1;
+		}
+
+		if (framing == Framing::LEGACY) {
+			if (length > LEGACY_MAX_PAYLOAD) {
+				return 0;
+			}
+			out[0] = length;
+			return 1;
+		}
+
+		size_t size = 0;
+		while (length >= 0x80) {
+			out[size++] = (length & 0x7f) | 0x80;
+			length >>= 7;
+		}
+		out[size++] = length;
+		return size;
+	}
+
+	// read a header from the front of buffer
+	// returns the header size, 0 if more bytes are needed, -1 if the header is invalid
+	static int decode(Framing framing, const RecvBuffer& buffer, uint32_t& length) {
+		uint8_t first = buffer.peek(0);
+
+		// common case, a single byte with the same meaning in both framings
+		if (first < 0x80 || framing == Framing::LEGACY) {
+			length = first;
+			return first ? 1 : -1;
+		}
+
+		length = first & 0x7f;
+		for (size_t i = 1; i < MAX_SIZE; i++) {
+			if (i >= buffer.size()) {
+				return 0;
+			}
+
+			uint8_t byte = buffer.peek(i);
+			length |= (uint32_t)(byte & 0x7f) << (7 * i);
+
+			if (!(byte & 0x80)) {
+				// reject padded encodings and anything too big
+				if (byte == 0 || length > MAX_PAYLOAD) {
+					return -1;
+				}
+				return i + 1;
+			}
+		}
+
+		return -1;
+	}
+};
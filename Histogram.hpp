@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#include <cstdint>
+
+// Counts of durations in nanoseconds, HDR style: exact below 64ns, then every power of two
+// split into 32 linear buckets, so any value is reported within about 3%. Buckets are relaxed
+// atomics, any thread can record while another reads percentiles out.
+class Histogram {
+public:
+	enum : uint32_t {
+		PRECISION = 5, // 2^PRECISION buckets per power of two
+		LINEAR = 2u << PRECISION, // values below this get a bucket each
+		MAX_SHIFT = 34, // up to 2^40ns, about 18 minutes
+		BUCKETS = LINEAR + MAX_SHIFT * (1u << PRECISION),
+	};
+
+	Histogram() : total(0), sum(0), max(0) {
+		for (auto& bucket : buckets) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void record(uint64_t ns) {
+		buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+		total.fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(ns, std::memory_order_relaxed);
+
+		uint64_t seen = max.load(std::memory_order_relaxed);
+		while (ns > seen && !max.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+	}
+
+	uint64_t count() const {
+		return total.load(std::memory_order_relaxed);
+	}
+
+	uint64_t mean() const {
+		uint64_t n = count();
+		return n ? sum.load(std::memory_order_relaxed) / n : 0;
+	}
+
+	uint64_t maximum() const {
+		return max.load(std::memory_order_relaxed);
+	}
+
+	// smallest value at least q (0..1) of the recorded ones are under, to the top of its bucket
+	uint64_t percentile(double q) const {
+		uint64_t n = 0;
+		for (auto& bucket : buckets) {
+			n += bucket.load(std::memory_order_relaxed);
+		}
+		if (n == 0) {
+			return 0;
+		}
+
+		uint64_t target = std::max<uint64_t>(1, uint64_t(q * n + 0.5));
+		uint64_t seen = 0;
+		for (uint32_t b = 0; b < BUCKETS; b++) {
+			seen += buckets[b].load(std::memory_order_relaxed);
+			if (seen >= target) {
+				return std::min(upperBound(b), maximum());
+			}
+		}
+		return maximum();
+	}
+
+	// one report row: name padded to width, then count, p50, p90, p99, p99.9 and max in
+	// microseconds, at whatever precision out is set to
+	void printRow(std::ostream& out, const std::string& name, int width) const {
+		out << std::left << std::setw(width) << name << std::right << std::setw(11) << count();
+		double qs[] = {0.5, 0.9, 0.99, 0.999};
+		for (double q : qs) {
+			out << std::setw(9) << percentile(q) / 1000.0;
+		}
+		out << std::setw(9) << maximum() / 1000.0 << "\n";
+	}
+
+	// d as the nanoseconds record() takes, a stamp taken before the one it's measured from reads as 0
+	template <typename Rep, typename Period>
+	static uint64_t nanoseconds(std::chrono::duration<Rep, Period> d) {
+		return std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+	}
+
+private:
+	std::atomic<uint64_t> buckets[BUCKETS];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+
+	static uint32_t bucketOf(uint64_t ns) {
+		if (ns < LINEAR) {
+			return ns;
+		}
+		uint32_t shift = 63 - __builtin_clzll(ns) - PRECISION;
+		if (shift > MAX_SHIFT) {
+			return BUCKETS - 1;
+		}
+		return LINEAR + (shift - 1) * (1u << PRECISION) + uint32_t(ns >> shift) - (1u << PRECISION);
+	}
+
+	static uint64_t upperBound(uint32_t b) {
+		if (b < LINEAR) {
+			return b;
+		}
+		uint32_t shift = (b - LINEAR) / (1u << PRECISION) + 1;
+		uint64_t top = (b - LINEAR) % (1u << PRECISION) + (1u << PRECISION);
+		return ((top + 1) << shift) - 1;
+	}
+};
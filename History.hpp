@@ -0,0 +1,121 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+#include "EntityStore.hpp"
+
+// One entity as it was at some tick, 16 bytes so four share a cache line
+struct PastTransform {
+	glm::vec3 position;
+	uint16_t slot; // EntityStore slot, the wire id
+	uint8_t role;
+	uint8_t flags;
+};
+
+// The last TICKS simulation steps of a room, for judging an action against the world the
+// acting client was looking at rather than the one the server has now (lag compensation).
+// Each tick is one flat array of PastTransform in dense order, so a rewind is a straight
+// copy plus a lerp and never touches the live EntityStore. Storage is only allocated once
+// the room starts recording, and reused from then on.
+class TransformHistory {
+public:
+	enum : uint32_t { TICKS = 64 }; // ~1s at 60Hz
+
+	// keep the store as of tick, ticks must be recorded in order
+	void record(const EntityStore& store, uint32_t tick) {
+		if (!frames) {
+			frames.reset(new Frame[TICKS]);
+			first = tick;
+		}
+
+		Frame& frame = frames[tick % TICKS];
+		frame.tick = tick;
+		frame.transforms.resize(store.size());
+		for (size_t i = 0; i < store.size(); i++) {
+			PastTransform& past = frame.transforms[i];
+			past.position = glm::vec3(store.position[i]);
+			past.slot = store.slotOf(i);
+			past.role = store.role[i];
+			past.flags = store.flags[i];
+		}
+		last = tick;
+	}
+
+	// range that can be rewound to, oldest > newest when nothing is recorded
+	uint32_t oldest() const {
+		return last >= first + TICKS ? last - TICKS + 1 : first;
+	}
+
+	uint32_t newest() const {
+		return last;
+	}
+
+	// the world at time, in ticks, a fraction lands between two recorded ticks (an interpolated
+	// client view). Entities only in the earlier tick keep their position there. False if out of range.
+	bool rewind(double time, std::vector<PastTransform>& out) const {
+		if (!frames || time < oldest() || time > newest()) {
+			return false;
+		}
+
+		uint32_t tick = (uint32_t)std::floor(time);
+		float t = float(time - tick);
+		const Frame& from = frames[tick % TICKS];
+		out.assign(from.transforms.begin(), from.transforms.end());
+		if (t == 0.0f) {
+			return true;
+		}
+
+		const Frame& to = frames[(tick + 1) % TICKS];
+		for (size_t i = 0; i < out.size(); i++) {
+			const PastTransform* next = find(to, out[i].slot, i);
+			if (next && next->role == out[i].role) {
+				out[i].position = glm::mix(out[i].position, next->position, t);
+			}
+		}
+		return true;
+	}
+
+	// fn(past transform, distance squared) for everything in a rewound world within r of center
+	// a linear scan, for a room's worth of entities it beats building a grid for one query
+	template <typename F>
+	static void radius(const std::vector<PastTransform>& at, const glm::vec3& center, float r, F fn) {
+		float r2 = r * r;
+		for (const PastTransform& past : at) {
+			glm::vec3 d = past.position - center;
+			float d2 = glm::dot(d, d);
+			if (d2 <= r2) {
+				fn(past, d2);
+			}
+		}
+	}
+
+private:
+	struct Frame {
+		uint32_t tick = 0;
+		std::vector<PastTransform> transforms;
+	};
+
+	std::unique_ptr<Frame[]> frames;
+	uint32_t first = 1;
+	uint32_t last = 0;
+
+	// dense order rarely changes between ticks, so look where it was first
+	static const PastTransform* find(const Frame& frame, uint16_t slot, size_t hint) {
+		if (hint < frame.transforms.size() && frame.transforms[hint].slot == slot) {
+			return &frame.transforms[hint];
+		}
+		for (const PastTransform& past : frame.transforms) {
+			if (past.slot == slot) {
+				return &past;
+			}
+		}
+		return nullptr;
+	}
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+// What a player did during one simulation tick
+struct InputCommand {
+	enum : size_t { SIZE = 5 }; // bytes on the wire
+
+	enum Button : uint8_t {
+		TAG = 1 << 0, // cop reaches for a robber, judged against what the cop saw
+	};
+
+	int8_t moveX = 0; // -127..127 along each axis
+	int8_t moveZ = 0;
+	uint16_t yaw = 0; // full turn is 65536
+	uint8_t buttons = 0;
+};
+
+/* INPUT payload, little endian:
+ *   u8 type, u32 sequence of the newest command, u8 count,
+ *   then count commands newest first, each moveX:i8 moveZ:i8 yaw:u16 buttons:u8
+ * Clients repeat their last few commands in every frame, so a lost or late frame
+ * costs nothing as long as a later one arrives.
+ */
+struct InputFrame {
+	enum : size_t { HEADER_SIZE = 6 };
+
+	// false if the payload is too short for what it claims
+	static bool parse(const std::vector<uint8_t>& payload, uint32_t& newest, uint8_t& count) {
+		if (payload.size() < HEADER_SIZE) {
+			return false;
+		}
+		newest = payload[1] | payload[2] << 8 | payload[3] << 16 | uint32_t(payload[4]) << 24;
+		count = payload[5];
+		return count > 0 && payload.size() >= HEADER_SIZE + count * InputCommand::SIZE;
+	}
+
+	// the k-th newest command, k < count
+	static InputCommand command(const std::vector<uint8_t>& payload, size_t k) {
+		const uint8_t* p = payload.data() + HEADER_SIZE + k * InputCommand::SIZE;
+		InputCommand c;
+		c.moveX = (int8_t)p[0];
+		c.moveZ = (int8_t)p[1];
+		c.yaw = p[2] | p[3] << 8;
+		c.buttons = p[4];
+		return c;
+	}
+
+	// how far a is past b, negative if it's behind, right across the uint32 wrap
+	static int32_t after(uint32_t a, uint32_t b) {
+		return (int32_t)(a - b);
+	}
+
+	// newer carries every command older does, so older can be dropped without a look
+	static bool covers(const std::vector<uint8_t>& newer, const std::vector<uint8_t>& older) {
+		uint32_t newerSeq, olderSeq;
+		uint8_t newerCount, olderCount;
+		if (!parse(newer, newerSeq, newerCount) || !parse(older, olderSeq, olderCount)) {
+			return false;
+		}
+		return after(newerSeq, olderSeq) >= 0 && after(olderSeq - olderCount, newerSeq - newerCount) >= 0;
+	}
+};
+
+// Per-client jitter buffer. Commands are slotted by sequence as they arrive, in any order,
+// and the simulation takes exactly one per tick. A command that hasn't arrived when its tick
+// comes is covered by repeating the previous one. Stale, duplicate and absurdly early
+// commands are dropped, and a buffer that backs up past MAX_DEPTH skips ahead so a client
+// whose clock runs fast doesn't build up latency.
+class InputBuffer {
+public:
+	enum : uint32_t {
+		SIZE = 32,
+		MAX_DEPTH = 4, // ticks of input we're willing to sit on
+	};
+
+	// false if the command was dropped
+	bool push(uint32_t sequence, const InputCommand& command) {
+		if (!started) {
+			if (sequence == 0) {
+				return false; // acked() of 0 means none, so the first one can't be 0
+			}
+			started = true;
+			applied = sequence - 1;
+			newest = applied;
+			for (Slot& slot : slots) {
+				slot.sequence = applied; // never ahead of applied, so never taken for a duplicate
+			}
+		}
+
+		// a client can start anywhere, so compare by distance rather than value
+		int32_t ahead = InputFrame::after(sequence, applied);
+		if (ahead <= 0 || ahead > (int32_t)SIZE) {
+			return false;
+		}
+
+		Slot& slot = slots[sequence % SIZE];
+		if (slot.sequence == sequence) {
+			return false; // duplicate
+		}
+		slot.sequence = sequence;
+		slot.command = command;
+		if (InputFrame::after(sequence, newest) > 0) {
+			newest = sequence;
+		}
+		return true;
+	}
+
+	// every command in an INPUT frame, returns how many were new
+	unsigned pushFrame(const std::vector<uint8_t>& payload) {
+		uint32_t sequence;
+		uint8_t count;
+		if (!InputFrame::parse(payload, sequence, count)) {
+			return 0;
+		}
+
+		unsigned accepted = 0;
+		// push() judges each by distance, so the ones from before a wrap still count
+		for (size_t k = 0; k < count; k++) {
+			accepted += push(sequence - k, InputFrame::command(payload, k));
+		}
+		return accepted;
+	}
+
+	// the command for this tick
+	InputCommand next() {
+		if (!started || InputFrame::after(newest, applied) <= 0) {
+			return last; // nothing new, keep doing what they were doing
+		}
+
+		// too far behind, drop the oldest
+		if (InputFrame::after(newest, applied) > (int32_t)MAX_DEPTH) {
+			applied = newest - MAX_DEPTH;
+		}
+
+		// the next one, or if it was lost for good the oldest one we do have
+		for (uint32_t sequence = applied + 1; InputFrame::after(sequence, newest) <= 0; sequence++) {
+			Slot& slot = slots[sequence % SIZE];
+			if (slot.sequence == sequence) {
+				applied = sequence;
+				last = slot.command;
+				return last;
+			}
+		}
+		return last;
+	}
+
+	// newest sequence applied, goes back to the client so it can reconcile
+	uint32_t acked() const {
+		return applied;
+	}
+
+private:
+	struct Slot {
+		uint32_t sequence = 0;
+		InputCommand command;
+	};
+
+	Slot slots[SIZE];
+	bool started = false;
+	uint32_t applied = 0;
+	uint32_t newest = 0;
+	InputCommand last;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+#include "EntityStore.hpp"
+#include "Protocol.hpp"
+#include "Snapshot.hpp"
+#include "SpatialGrid.hpp"
+
+// Decides what each client gets to know about, between simulation and snapshot encoding.
+// A client's view holds its own entity and its team wherever they are, and anything else
+// within RELEVANT_RADIUS. Cops only see a free robber within VIEW_RADIUS, so the robber's
+// position never reaches a cop's machine while it's hidden. Relevant entities further
+// away are refreshed every 2nd or 4th snapshot, in between the view repeats what the
+// client's baseline already has so the delta carries nothing for them.
+// Each entity in view also gets a weight for PriorityAccumulator: the client's own entity
+// always goes first, a spotted robber counts extra for a cop, and the rest fall off with distance.
+class Interest {
+public:
+	static constexpr float NEAR_RADIUS = 15.0f; // every snapshot inside this
+	static constexpr float RELEVANT_RADIUS = 60.0f;
+	static constexpr float VIEW_RADIUS = 25.0f; // how far a cop can spot the robber
+	static constexpr float OWN_WEIGHT = 1000.0f;
+	static constexpr float SPOTTED_WEIGHT = 4.0f;
+
+	// fill view with what the viewer (dense index into entities) should be sent, and weights by slot
+	// world and grid must be from the same step as entities, baseline is what the client last acked
+	static void filter(const WorldSnapshot& world, const EntityStore& entities, const SpatialGrid& grid,
+			uint32_t viewer, const WorldSnapshot* baseline, uint32_t netTick, WorldSnapshot& view, std::vector<float>& weights) {
+		view.tick = world.tick;
+		view.entities.assign(world.entities.size(), EntityState());
+		weights.assign(world.entities.size(), 0.0f);
+
+		uint8_t team = entities.role[viewer];
+		glm::vec3 eye(entities.position[viewer]);
+
+		// own team, wherever they are
+		for (uint32_t i = 0; i < entities.size(); i++) {
+			if (i == viewer) {
+				copy(world, entities.slotOf(i), view);
+				weights[entities.slotOf(i)] = OWN_WEIGHT;
+			} else if (team != Protocol::NONE && entities.role[i] == team) {
+				glm::vec3 d = glm::vec3(entities.position[i]) - eye;
+				copy(world, entities.slotOf(i), view);
+				weights[entities.slotOf(i)] = falloff(glm::dot(d, d));
+			}
+		}
+
+		grid.radius(eye, RELEVANT_RADIUS, [&](uint32_t i, float d2) {
+			uint32_t slot = entities.slotOf(i);
+			if (view.entities[slot].present) {
+				return;
+			}
+
+			uint8_t role = entities.role[i];
+			bool caught = entities.flags[i] & EntityStore::CAPTURED;
+			if (team == Protocol::COP && role == Protocol::ROBBER && !caught) {
+				if (d2 > VIEW_RADIUS * VIEW_RADIUS) {
+					return;
+				}
+				copy(world, slot, view); // always fresh once spotted
+				weights[slot] = SPOTTED_WEIGHT * falloff(d2);
+				return;
+			}
+
+			// far things can wait, staggered by slot so they don't all refresh on the same tick
+			uint32_t period = d2 < NEAR_RADIUS * NEAR_RADIUS ? 1 : d2 < 4 * NEAR_RADIUS * NEAR_RADIUS ? 2 : 4;
+			if ((netTick + slot) % period != 0 && baseline && baseline->has(slot)
+					&& baseline->entities[slot].generation == world.entities[slot].generation) {
+				view.entities[slot] = baseline->entities[slot];
+				return;
+			}
+			copy(world, slot, view);
+			weights[slot] = falloff(d2);
+		});
+
+		// drop the tail nobody in view uses, keeps the slot count on the wire down
+		while (!view.entities.empty() && !view.entities.back().present) {
+			view.entities.pop_back();
+		}
+	}
+
+	// for a client with no entity to see from (dead, not spawned, spectating): nothing at all,
+	// whatever its baseline holds goes out as removed
+	static void unseen(const WorldSnapshot& world, WorldSnapshot& view, std::vector<float>& weights) {
+		view.tick = world.tick;
+		view.entities.clear();
+		weights.clear();
+	}
+
+private:
+	// 1 inside NEAR_RADIUS, then inversely with distance
+	static float falloff(float d2) {
+		float d = std::sqrt(d2);
+		return d > NEAR_RADIUS ? NEAR_RADIUS / d : 1.0f;
+	}
+
+	static void copy(const WorldSnapshot& world, uint32_t slot, WorldSnapshot& view) {
+		view.entities[slot] = world.entities[slot];
+	}
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Histogram.hpp"
+
+// How long messages take from the recv that brought them in to the send that put the answer
+// on the wire, by message type. Inbound packets are stamped at recv. A handler opens a
+// Handling for the frame it works on, and every packet made on that thread meanwhile (a reply,
+// each copy of a broadcast) carries the stamp into the write queues, so the transport can
+// file it once the last byte is out.
+class MessageLatency {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum : size_t { TYPES = 16 }; // higher types share the last, like Profiler's
+
+	struct Stamp {
+		Clock::time_point received; // off the wire, left at the epoch when untraced
+		Clock::time_point handled; // its handler started, for packets answering it
+		uint8_t type = 0; // of the inbound message
+
+		bool answers() const {
+			return handled != Clock::time_point();
+		}
+	};
+
+	// packets made on this thread while it's open answer inbound
+	class Handling {
+	public:
+		explicit Handling(const Stamp& inbound, uint8_t type) : previous(current()) {
+			Stamp& stamp = currentStamp();
+			if (inbound.received == Clock::time_point()) {
+				stamp = Stamp();
+				return;
+			}
+
+			stamp.received = inbound.received;
+			stamp.handled = Clock::now();
+			stamp.type = type;
+			totals().recvToHandle[slot(type)].record(Histogram::nanoseconds(stamp.handled - stamp.received));
+		}
+
+		~Handling() {
+			currentStamp() = previous;
+		}
+
+		Handling(const Handling&) = delete;
+		Handling& operator=(const Handling&) = delete;
+
+	private:
+		Stamp previous; // handlers don't nest today, but restoring keeps it right if they do
+	};
+
+	// what a packet made right now answers, if anything
+	static const Stamp& current() {
+		return currentStamp();
+	}
+
+	// a frame carrying stamp just went out whole
+	static void wired(const Stamp& stamp, Clock::time_point now) {
+		if (!stamp.answers()) {
+			return;
+		}
+		Totals& t = totals();
+		t.handleToWire[slot(stamp.type)].record(Histogram::nanoseconds(now - stamp.handled));
+		t.recvToWire[slot(stamp.type)].record(Histogram::nanoseconds(now - stamp.received));
+	}
+
+	static const Histogram& recvToHandle(uint8_t type) {
+		return totals().recvToHandle[slot(type)];
+	}
+
+	static const Histogram& handleToWire(uint8_t type) {
+		return totals().handleToWire[slot(type)];
+	}
+
+	// percentiles by message type in microseconds, types never seen are left out
+	static void report(std::ostream& out) {
+		std::ostringstream s;
+		s << std::fixed << std::setprecision(1);
+		s << "latency (us)                    count      p50      p90      p99    p99.9      max\n";
+		for (size_t type = 0; type < TYPES; type++) {
+			std::string name = "message " + std::to_string(type) + (type == TYPES - 1 ? "+" : "");
+			auto row = [&](const char* leg, const Histogram& h) {
+				if (h.count()) {
+					h.printRow(s, name + leg, 26);
+				}
+			};
+			row(" recv>handle", totals().recvToHandle[type]);
+			row(" handle>wire", totals().handleToWire[type]);
+			row(" recv>wire", totals().recvToWire[type]);
+		}
+		out << s.str() << std::flush;
+	}
+
+private:
+	struct Totals {
+		Histogram recvToHandle[TYPES];
+		Histogram handleToWire[TYPES];
+		Histogram recvToWire[TYPES];
+	};
+
+	static Totals& totals() {
+		static Totals instance;
+		return instance;
+	}
+
+	static Stamp& currentStamp() {
+		static thread_local Stamp stamp;
+		return stamp;
+	}
+
+	static size_t slot(uint8_t type) {
+		return std::min<size_t>(type, TYPES - 1);
+	}
+};
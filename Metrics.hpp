@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Histogram.hpp"
+
+// A counter only one thread ever writes and any thread can read. The writer does a plain
+// relaxed load and store, no locked add, so counting costs about as much as a normal increment.
+class Counter {
+public:
+	void add(uint64_t n) {
+		value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	// keep the highest value seen, for high-water marks
+	void raise(uint64_t n) {
+		if (n > value.load(std::memory_order_relaxed)) {
+			value.store(n, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t get() const {
+		return value.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> value{0};
+};
+
+// What went through one connection, or summed over a room's or the whole process's.
+// Queue depths are frames, waits are from writeQueue.enqueue() until the frame's last byte
+// was handed to the kernel, so a big wait with few partial sends points at the server and
+// lots of partial sends at the client's link.
+struct TrafficStats {
+	uint64_t bytesIn = 0;
+	uint64_t framesIn = 0;
+	uint64_t recvCalls = 0; // recv syscalls, or io_uring completions
+	uint64_t bytesOut = 0;
+	uint64_t framesOut = 0;
+	uint64_t sendCalls = 0; // sendmsg syscalls, or io_uring writes
+	uint64_t partialSends = 0; // sends the kernel took only part of
+	uint64_t largestBatch = 0; // most frames finished by one send
+	uint64_t framesDropped = 0; // too big for the connection's framing, never sent
+	uint64_t readQueueDepth = 0; // right now, waiting for the room
+	uint64_t readQueueHigh = 0; // the most there ever were
+	uint64_t writeQueueDepth = 0;
+	uint64_t writeQueueHigh = 0;
+	uint64_t writeWaitNs = 0; // summed over framesOut
+	uint64_t writeWaitMaxNs = 0;
+	uint64_t connections = 0;
+
+	// counts add up, high-water marks and maxima take the larger
+	TrafficStats& operator+=(const TrafficStats& other) {
+		bytesIn += other.bytesIn;
+		framesIn += other.framesIn;
+		recvCalls += other.recvCalls;
+		bytesOut += other.bytesOut;
+		framesOut += other.framesOut;
+		sendCalls += other.sendCalls;
+		partialSends += other.partialSends;
+		largestBatch = std::max(largestBatch, other.largestBatch);
+		framesDropped += other.framesDropped;
+		readQueueDepth += other.readQueueDepth;
+		readQueueHigh = std::max(readQueueHigh, other.readQueueHigh);
+		writeQueueDepth += other.writeQueueDepth;
+		writeQueueHigh = std::max(writeQueueHigh, other.writeQueueHigh);
+		writeWaitNs += other.writeWaitNs;
+		writeWaitMaxNs = std::max(writeWaitMaxNs, other.writeWaitMaxNs);
+		connections += other.connections;
+		return *this;
+	}
+
+	// one line, no newline
+	void print(std::ostream& out) const {
+		out << "in " << bytesIn << "B/" << framesIn << " frames/" << recvCalls << " recvs"
+			<< ", out " << bytesOut << "B/" << framesOut << " frames/" << sendCalls << " sends (" << partialSends << " partial"
+			<< ", largest batch " << largestBatch << ", " << framesDropped << " dropped)"
+			<< ", read queue " << readQueueDepth << " (high " << readQueueHigh << ")"
+			<< ", write queue " << writeQueueDepth << " (high " << writeQueueHigh << ")"
+			<< ", write wait mean " << (framesOut ? writeWaitNs / framesOut / 1000 : 0) << "us max " << writeWaitMaxNs / 1000 << "us";
+	}
+};
+
+// TrafficStats summed over every connection the process has had, counters sharded by thread
+// so transport threads don't bounce a cache line between them
+class TrafficTotals {
+public:
+	enum Field {
+		BYTES_IN,
+		FRAMES_IN,
+		RECV_CALLS,
+		BYTES_OUT,
+		FRAMES_OUT,
+		SEND_CALLS,
+		PARTIAL_SENDS,
+		FRAMES_DROPPED,
+		WRITE_WAIT_NS,
+		CONNECTIONS,
+		FIELDS,
+	};
+
+	static void add(Field field, uint64_t n) {
+		shard().counts[field].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	static void raise(std::atomic<uint64_t>& high, uint64_t n) {
+		uint64_t seen = high.load(std::memory_order_relaxed);
+		while (n > seen && !high.compare_exchange_weak(seen, n, std::memory_order_relaxed)) {}
+	}
+
+	static void wrote(uint64_t waitNs) {
+		add(WRITE_WAIT_NS, waitNs);
+		raise(maxima().writeWaitMaxNs, waitNs);
+		writeWait().record(waitNs);
+	}
+
+	static void readQueueDepth(uint64_t depth) {
+		raise(maxima().readQueueHigh, depth);
+	}
+
+	static void writeQueueDepth(uint64_t depth) {
+		raise(maxima().writeQueueHigh, depth);
+	}
+
+	static void largestBatch(uint64_t frames) {
+		raise(maxima().largestBatch, frames);
+	}
+
+	// depths aren't tracked process wide, only high-water marks
+	static TrafficStats total() {
+		uint64_t sum[FIELDS] = {};
+		for (size_t s = 0; s < SHARDS; s++) {
+			for (size_t f = 0; f < FIELDS; f++) {
+				sum[f] += shards()[s].counts[f].load(std::memory_order_relaxed);
+			}
+		}
+
+		TrafficStats stats;
+		stats.bytesIn = sum[BYTES_IN];
+		stats.framesIn = sum[FRAMES_IN];
+		stats.recvCalls = sum[RECV_CALLS];
+		stats.bytesOut = sum[BYTES_OUT];
+		stats.framesOut = sum[FRAMES_OUT];
+		stats.sendCalls = sum[SEND_CALLS];
+		stats.partialSends = sum[PARTIAL_SENDS];
+		stats.framesDropped = sum[FRAMES_DROPPED];
+		stats.writeWaitNs = sum[WRITE_WAIT_NS];
+		stats.connections = sum[CONNECTIONS];
+		stats.largestBatch = maxima().largestBatch.load(std::memory_order_relaxed);
+		stats.readQueueHigh = maxima().readQueueHigh.load(std::memory_order_relaxed);
+		stats.writeQueueHigh = maxima().writeQueueHigh.load(std::memory_order_relaxed);
+		stats.writeWaitMaxNs = maxima().writeWaitMaxNs.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	// every frame's wait in a writeQueue, for percentiles
+	static Histogram& writeWait() {
+		static Histogram instance;
+		return instance;
+	}
+
+private:
+	enum : size_t { SHARDS = 16 };
+
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> counts[FIELDS];
+
+		Shard() {
+			for (auto& count : counts) {
+				count.store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	struct Maxima {
+		std::atomic<uint64_t> largestBatch;
+		std::atomic<uint64_t> readQueueHigh;
+		std::atomic<uint64_t> writeQueueHigh;
+		std::atomic<uint64_t> writeWaitMaxNs;
+
+		Maxima() : largestBatch(0), readQueueHigh(0), writeQueueHigh(0), writeWaitMaxNs(0) {}
+	};
+
+	static Shard* shards() {
+		static Shard instance[SHARDS];
+		return instance;
+	}
+
+	// threads take shards round robin
+	static Shard& shard() {
+		static std::atomic<unsigned> next(0);
+		static thread_local unsigned mine = next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+		return shards()[mine];
+	}
+
+	static Maxima& maxima() {
+		static Maxima instance;
+		return instance;
+	}
+};
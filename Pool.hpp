@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cstddef>
+
+// Slab allocator for objects that get recycled instead of destroyed.
+// Every thread keeps a small cache so get/put normally don't touch the lock, caches
+// refill from and spill to a shared free list in batches. Objects are constructed once
+// when their slab is allocated and are never handed back to the heap.
+template <typename T, size_t SLAB = 64, size_t BATCH = 64>
+class Pool {
+
+	struct Shared {
+		std::mutex mutex;
+		std::vector<T*> free;
+		std::vector<std::unique_ptr<T[]>> slabs;
+	};
+
+	struct Cache {
+		std::vector<T*> items;
+
+		Cache() {
+			items.reserve(2 * BATCH);
+		}
+
+		// thread is exiting, give everything back
+		~Cache() {
+			spill(*this, items.size());
+		}
+	};
+
+	// leaked on purpose, objects can still be released while the process tears down
+	static Shared& shared() {
+		static Shared* instance = new Shared();
+		return *instance;
+	}
+
+	static Cache& cache() {
+		static thread_local Cache instance;
+		return instance;
+	}
+
+	static void refill(Cache& cache) {
+		Shared& pool = shared();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+
+		while (pool.free.size() < BATCH) {
+			T* slab = new T[SLAB];
+			pool.slabs.emplace_back(slab);
+			for (size_t i = 0; i < SLAB; i++) {
+				pool.free.push_back(slab + i);
+			}
+		}
+
+		cache.items.insert(cache.items.end(), pool.free.end() - BATCH, pool.free.end());
+		pool.free.resize(pool.free.size() - BATCH);
+	}
+
+	static void spill(Cache& cache, size_t n) {
+		Shared& pool = shared();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+
+		pool.free.insert(pool.free.end(), cache.items.end() - n, cache.items.end());
+		cache.items.resize(cache.items.size() - n);
+	}
+
+public:
+	static T* get() {
+		Cache& local = cache();
+		if (local.items.empty()) {
+			refill(local);
+		}
+
+		T* item = local.items.back();
+		local.items.pop_back();
+		return item;
+	}
+
+	// item must be back in its just-constructed state (or close enough for the caller)
+	static void put(T* item) {
+		Cache& local = cache();
+		local.items.push_back(item);
+
+		if (local.items.size() >= 2 * BATCH) {
+			spill(local, BATCH);
+		}
+	}
+
+	// objects ever allocated, for diagnostics
+	static size_t allocated() {
+		Shared& pool = shared();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		return pool.slabs.size() * SLAB;
+	}
+};
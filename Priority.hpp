@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Snapshot.hpp"
+
+// Keeps one client's snapshots inside a byte budget per send. Every entity the client is
+// behind on gains its weight in priority each snapshot it's left out of, so one that keeps
+// losing climbs until it wins. A snapshot is filled highest priority first, and whatever
+// doesn't fit is held at the baseline's state so the delta carries nothing for it.
+// Removals always go, they're a few bits each.
+class PriorityAccumulator {
+public:
+	// trim view so encoding it against baseline takes at most budget bytes,
+	// weights by slot as Interest gave them, missing ones count 1
+	void fit(WorldSnapshot& view, const WorldSnapshot* baseline, const std::vector<float>& weights,
+			size_t budget, const SnapshotFormat& format) {
+		size_t count = std::max(view.used(), baseline ? baseline->used() : 0);
+		if (priority.size() < count) {
+			priority.resize(count, 0.0f);
+		}
+
+		// the header and a changed bit per slot are paid whatever goes in
+		size_t fixed = SnapshotEncoder::HEADER_SIZE * 8 + count;
+		size_t left = budget * 8 > fixed ? budget * 8 - fixed : 0;
+
+		candidates.clear();
+		for (size_t slot = 0; slot < count; slot++) {
+			size_t bits = SnapshotEncoder::slotBits(view, baseline, slot, format);
+			if (bits == 0) {
+				priority[slot] = 0.0f; // the client is up to date on it
+				continue;
+			}
+			if (!view.has(slot)) {
+				left -= std::min(left, bits);
+				priority[slot] = 0.0f;
+				continue;
+			}
+
+			priority[slot] += slot < weights.size() ? weights[slot] : 1.0f;
+			candidates.push_back(Candidate{priority[slot], uint32_t(slot), uint32_t(bits)});
+		}
+
+		// ties go to the lower slot so the order doesn't depend on the sort
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+			return a.priority > b.priority || (a.priority == b.priority && a.slot < b.slot);
+		});
+
+		for (const Candidate& candidate : candidates) {
+			if (candidate.bits <= left) {
+				left -= candidate.bits;
+				priority[candidate.slot] = 0.0f;
+				continue;
+			}
+
+			// next time, with what it has so far
+			held++;
+			if (baseline && baseline->has(candidate.slot)) {
+				view.entities[candidate.slot] = baseline->entities[candidate.slot];
+			} else {
+				view.entities[candidate.slot] = EntityState();
+			}
+		}
+	}
+
+	// entity updates that didn't fit, since the start
+	uint64_t getHeld() const {
+		return held;
+	}
+
+private:
+	struct Candidate {
+		float priority;
+		uint32_t slot;
+		uint32_t bits;
+	};
+
+	std::vector<float> priority; // by slot
+	std::vector<Candidate> candidates; // scratch
+	uint64_t held = 0;
+};
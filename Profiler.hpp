@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Histogram.hpp"
+
+// Where a room's tick goes. Scopes add the time spent in each phase to the tick running on
+// this thread, and end() files the tick into process wide histograms and, past the slow tick
+// threshold, logs everything about it. Percentiles can be read out (report()) at any time.
+class Profiler {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum Phase {
+		TICK, // a whole Room::run
+		DRAIN, // taking messages off the TCP and UDP queues
+		SIMULATE,
+		ENCODE, // capture, interest, budget and encoding of snapshots
+		ENQUEUE, // handing snapshots to the transports
+		LOBBY, // one pass of the lobby loop
+		PHASES,
+	};
+
+	enum : size_t { MESSAGE_TYPES = 16 }; // handler time by message type, higher types share the last
+
+	// adds the time until it goes out of scope to phase
+	class Scope {
+	public:
+		explicit Scope(Phase phase) : phase(phase), start(Clock::now()) {}
+
+		~Scope() {
+			Tick& tick = current();
+			tick.ns[phase] += Histogram::nanoseconds(Clock::now() - start);
+			tick.runs[phase]++;
+		}
+
+	private:
+		Phase phase;
+		Clock::time_point start;
+	};
+
+	// adds the time until it goes out of scope to the handler for a message type
+	class Message {
+	public:
+		explicit Message(uint8_t type) : type(std::min<size_t>(type, MESSAGE_TYPES - 1)), start(Clock::now()) {}
+
+		~Message() {
+			Tick& tick = current();
+			tick.messageNs[type] += Histogram::nanoseconds(Clock::now() - start);
+			tick.messages[type]++;
+		}
+
+	private:
+		size_t type;
+		Clock::time_point start;
+	};
+
+	// a room tick starts on this thread
+	static void begin() {
+		Tick& tick = current();
+		tick = Tick();
+		tick.start = Clock::now();
+	}
+
+	// and ends, with what it did for the slow tick log
+	static void end(uint32_t room, unsigned steps, size_t clients, size_t entities) {
+		Tick& tick = current();
+		tick.ns[TICK] = Histogram::nanoseconds(Clock::now() - tick.start);
+		tick.runs[TICK] = 1;
+
+		Totals& t = totals();
+		for (size_t phase = 0; phase < PHASES; phase++) {
+			if (tick.runs[phase]) {
+				t.phases[phase].record(tick.ns[phase]);
+			}
+		}
+		for (size_t type = 0; type < MESSAGE_TYPES; type++) {
+			if (tick.messages[type]) {
+				t.messages[type].record(tick.messageNs[type] / tick.messages[type]);
+			}
+		}
+
+		if (tick.ns[TICK] >= t.slowTickNs.load(std::memory_order_relaxed)) {
+			slow(tick, room, steps, clients, entities);
+		}
+	}
+
+	static void record(Phase phase, Clock::duration duration) {
+		totals().phases[phase].record(Histogram::nanoseconds(duration));
+	}
+
+	static const Histogram& phase(Phase phase) {
+		return totals().phases[phase];
+	}
+
+	// mean handler time per message, by type
+	static const Histogram& message(uint8_t type) {
+		return totals().messages[std::min<size_t>(type, MESSAGE_TYPES - 1)];
+	}
+
+	// ticks at least this long get logged
+	static void setSlowTick(Clock::duration threshold) {
+		totals().slowTickNs.store(Histogram::nanoseconds(threshold), std::memory_order_relaxed);
+	}
+
+	// percentiles of every phase and message type seen so far, in microseconds
+	static void report(std::ostream& out) {
+		std::ostringstream s;
+		s << std::fixed << std::setprecision(1);
+		s << "profile (us)          count      p50      p90      p99    p99.9      max\n";
+		for (size_t p = 0; p < PHASES; p++) {
+			totals().phases[p].printRow(s, name(p), 16);
+		}
+		for (size_t type = 0; type < MESSAGE_TYPES; type++) {
+			if (totals().messages[type].count()) {
+				totals().messages[type].printRow(s, "message " + std::to_string(type) + (type == MESSAGE_TYPES - 1 ? "+" : ""), 16);
+			}
+		}
+		s << "slow ticks: " << totals().slowTicks.load(std::memory_order_relaxed) << "\n";
+		out << s.str() << std::flush;
+	}
+
+private:
+	struct Tick {
+		Clock::time_point start;
+		uint64_t ns[PHASES] = {};
+		uint32_t runs[PHASES] = {};
+		uint64_t messageNs[MESSAGE_TYPES] = {};
+		uint32_t messages[MESSAGE_TYPES] = {};
+	};
+
+	struct Totals {
+		Histogram phases[PHASES];
+		Histogram messages[MESSAGE_TYPES];
+		std::atomic<uint64_t> slowTickNs;
+		std::atomic<uint64_t> slowTicks;
+		std::atomic<int64_t> lastDump; // ns since the clock's epoch
+		std::atomic<uint64_t> quiet; // slow ticks not logged since the last one that was
+
+		Totals() : slowTickNs(5000000), slowTicks(0), lastDump(0), quiet(0) {}
+	};
+
+	static const char* name(size_t phase) {
+		static const char* names[PHASES] = {"tick", "drain", "simulate", "encode", "enqueue", "lobby"};
+		return names[phase];
+	}
+
+	static Totals& totals() {
+		static Totals instance;
+		return instance;
+	}
+
+	static Tick& current() {
+		static thread_local Tick tick;
+		return tick;
+	}
+
+	// log the breakdown of a slow tick, at most once a second so an overloaded server isn't also flooding its log
+	static void slow(const Tick& tick, uint32_t room, unsigned steps, size_t clients, size_t entities) {
+		Totals& t = totals();
+		t.slowTicks.fetch_add(1, std::memory_order_relaxed);
+
+		int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+		int64_t last = t.lastDump.load(std::memory_order_relaxed);
+		if (now - last < 1000000000 || !t.lastDump.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+			t.quiet.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		std::ostringstream s;
+		s << std::fixed << std::setprecision(3);
+		s << "slow tick: room " << room << " took " << tick.ns[TICK] / 1e6 << "ms, " << steps << " steps, "
+			<< clients << " clients, " << entities << " entities";
+		uint64_t quiet = t.quiet.exchange(0, std::memory_order_relaxed);
+		if (quiet) {
+			s << " (" << quiet << " more since the last one logged)";
+		}
+
+		// then where the time went, on a line of its own
+		std::ostringstream phases;
+		phases << std::fixed << std::setprecision(3);
+		for (size_t p = DRAIN; p < PHASES; p++) {
+			if (tick.runs[p]) {
+				phases << " " << name(p) << " " << tick.ns[p] / 1e6 << "ms x" << tick.runs[p];
+			}
+		}
+		for (size_t type = 0; type < MESSAGE_TYPES; type++) {
+			if (tick.messages[type]) {
+				phases << " message " << type << " " << tick.messageNs[type] / 1e6 << "ms x" << tick.messages[type];
+			}
+		}
+		if (phases.tellp() > 0) {
+			s << "\n " << phases.str();
+		}
+		std::cout << s.str() << std::endl;
+	}
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What the server and its clients say to each other, on their own so tools that talk to the
+// server (loadgen.cpp) don't have to pull the server in to know the messages.
+
+enum MessageType {
+	STAGING_PLAYER_CONNECT,
+	STAGING_PLAYER_DISCONNECT,
+	STAGING_VOTE_TO_START,
+	STAGING_VETO_START,
+	STAGING_START_GAME,
+	STAGING_ROLE_CHANGE,
+	STAGING_ROLE_CHANGE_REJECTION,
+	STAGING_PLAYER_SYNC,
+	INPUT,
+	// client asks for varint frame headers, server echoes it back (see Socket). Each side switches
+	// what it writes right after its own FRAMING_VARINT and what it reads right after the other's,
+	// so the client's next frame after the request is already varint, and so is the server's after the echo
+	FRAMING_VARINT,
+	UDP_TOKEN, // server tells the client the token to put in its UDP datagrams (see UdpChannel)
+	JOIN_ROOM, // client picks an existing room by u32 id (little endian), 0 or no id to be matched, server echoes the room it got
+	JOIN_ROOM_REJECTION, // no such room, or it's full or already playing, client stays in the lobby
+	SNAPSHOT, // world state, delta against the last one the client acked (see Snapshot.hpp)
+	SNAPSHOT_ACK, // client got the snapshot for u32 tick, later deltas can be taken against it
+	ROBBER_CAPTURED, // u8 entity slot of a robber a cop caught, reliable over UDP once the client has a route
+};
+
+struct Protocol {
+	enum : size_t { MAX_PLAYERS = 3 }; // in one room
+
+	// a player's side, STAGING_ROLE_CHANGE carries it as a u8
+	enum Role : uint8_t {
+		NONE,
+		ROBBER,
+		COP,
+	};
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX__) || defined(__SSE2__)
+	#include <immintrin.h>
+#endif
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "glm/gtc/type_aligned.hpp"
+
+// Maps world space inside [min, max] onto fixed point, bits[axis] wide (up to 24), rounding
+// to the nearest step and clamping anything outside. glm's packSnorm/packUnorm only come in
+// 8 and 16 bit widths over [-1, 1], this takes any width over the map.
+class Quantizer {
+public:
+	Quantizer(const glm::vec3& min, const glm::vec3& max, const glm::uvec3& bits)
+			: min(min), bits(bits) {
+		for (int axis = 0; axis < 3; axis++) {
+			top[axis] = float((1u << bits[axis]) - 1);
+			scale[axis] = top[axis] / (max[axis] - min[axis]);
+		}
+	}
+
+	const glm::uvec3& getBits() const {
+		return bits;
+	}
+
+	glm::uvec3 quantize(const glm::vec3& v) const {
+		// round half to even like the vector path does
+		glm::vec3 q = glm::clamp((v - min) * scale, glm::vec3(0.0f), top);
+		return glm::uvec3(std::nearbyint(q.x), std::nearbyint(q.y), std::nearbyint(q.z));
+	}
+
+	glm::vec3 dequantize(const glm::uvec3& q) const {
+		return min + glm::vec3(q) / scale;
+	}
+
+	// every entry of in at once, the w lane is ignored
+	void quantize(const std::vector<glm::aligned_vec4>& in, std::vector<glm::uvec4>& out) const {
+		size_t n = in.size();
+		out.resize(n);
+		if (n == 0) {
+			return;
+		}
+
+		size_t i = 0;
+
+#if defined(__AVX__) || defined(__SSE2__)
+		const float* p = &in[0].x;
+		uint32_t* q = &out[0].x;
+#endif
+
+#if defined(__AVX__)
+		// two entries per register
+		__m256 lo = _mm256_setr_ps(min.x, min.y, min.z, 0.0f, min.x, min.y, min.z, 0.0f);
+		__m256 mul = _mm256_setr_ps(scale.x, scale.y, scale.z, 0.0f, scale.x, scale.y, scale.z, 0.0f);
+		__m256 hi = _mm256_setr_ps(top.x, top.y, top.z, 0.0f, top.x, top.y, top.z, 0.0f);
+		__m256 zero = _mm256_setzero_ps();
+		for (; i + 2 <= n; i += 2) {
+			__m256 v = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p + 4 * i), lo), mul);
+			v = _mm256_min_ps(_mm256_max_ps(v, zero), hi);
+			_mm256_storeu_si256((__m256i*)(q + 4 * i), _mm256_cvtps_epi32(v)); // rounds to nearest
+		}
+#elif defined(__SSE2__)
+		__m128 lo = _mm_setr_ps(min.x, min.y, min.z, 0.0f);
+		__m128 mul = _mm_setr_ps(scale.x, scale.y, scale.z, 0.0f);
+		__m128 hi = _mm_setr_ps(top.x, top.y, top.z, 0.0f);
+		__m128 zero = _mm_setzero_ps();
+		for (; i < n; i++) {
+			__m128 v = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(p + 4 * i), lo), mul);
+			v = _mm_min_ps(_mm_max_ps(v, zero), hi);
+			_mm_storeu_si128((__m128i*)(q + 4 * i), _mm_cvtps_epi32(v));
+		}
+#endif
+
+		for (; i < n; i++) {
+			out[i] = glm::uvec4(quantize(glm::vec3(in[i])), 0);
+		}
+	}
+
+private:
+	glm::vec3 min;
+	glm::vec3 scale; // steps per world unit
+	glm::vec3 top; // largest step
+	glm::uvec3 bits;
+};
+
+// Unit quaternion as its three smallest components plus which one was left out, the
+// largest, which the receiver rebuilds from the unit length. The three can't exceed
+// 1/sqrt(2) in magnitude so that's the range they're quantized over.
+// Packed: bits 0..1 index of the largest (x y z w), then three BITS wide components in order.
+struct SmallestThree {
+	enum : unsigned { BITS = 8 }; // under half a degree
+	enum : unsigned { PACKED_BITS = 2 + 3 * BITS };
+
+	static uint32_t pack(const glm::quat& q) {
+		unsigned largest = 0;
+		for (unsigned c = 1; c < 4; c++) {
+			if (std::fabs(q[c]) > std::fabs(q[largest])) {
+				largest = c;
+			}
+		}
+
+		// q and -q are the same rotation, make the dropped one positive
+		float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+		float top = float((1u << BITS) - 1);
+
+		uint32_t packed = largest;
+		unsigned shift = 2;
+		for (unsigned c = 0; c < 4; c++) {
+			if (c == largest) {
+				continue;
+			}
+			float v = (sign * q[c] * RANGE + 1.0f) * 0.5f; // 0..1
+			packed |= uint32_t(std::floor(glm::clamp(v, 0.0f, 1.0f) * top + 0.5f)) << shift;
+			shift += BITS;
+		}
+		return packed;
+	}
+
+	static glm::quat unpack(uint32_t packed) {
+		unsigned largest = packed & 3;
+		float top = float((1u << BITS) - 1);
+
+		glm::quat q;
+		float sum = 0.0f;
+		unsigned shift = 2;
+		for (unsigned c = 0; c < 4; c++) {
+			if (c == largest) {
+				continue;
+			}
+			float v = float((packed >> shift) & ((1u << BITS) - 1)) / top;
+			q[c] = (v * 2.0f - 1.0f) / RANGE;
+			sum += q[c] * q[c];
+			shift += BITS;
+		}
+		q[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+		return q;
+	}
+
+private:
+	static constexpr float RANGE = 1.41421356f; // sqrt(2), maps +-1/sqrt(2) onto +-1
+};
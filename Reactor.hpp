@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// Anything with an fd that wants readiness events from the reactor
+class ReactorHandler {
+public:
+	virtual ~ReactorHandler() {}
+
+	// epoll reported events on our fd, return false to be unregistered
+	virtual bool onEvents(uint32_t events) = 0;
+
+	// someone called Reactor::schedule for our fd, return false to be unregistered
+	virtual bool onWake() = 0;
+};
+
+// A single edge-triggered epoll loop that owns every client fd.
+// The thread count stays at one no matter how many sockets are registered.
+class Reactor {
+
+	int epfd;
+	int wakefd;
+	std::atomic<bool> woken;
+
+	// held while dispatching, so once remove() returns the handler is never called again
+	std::mutex handlersMutex;
+	std::vector<ReactorHandler*> handlers; // indexed by fd
+
+	std::mutex pendingMutex;
+	std::vector<int> pending; // fds that asked for onWake
+
+	std::thread thread;
+
+	Reactor() : woken(false) {
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd == -1) {
+			perror("epoll_create1");
+			exit(1);
+		}
+
+		wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (wakefd == -1) {
+			perror("eventfd");
+			exit(1);
+		}
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = wakefd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) == -1) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+
+		thread = std::thread([this]() { run(); });
+		thread.detach();
+	}
+
+public:
+	// lives for the whole process, never destroyed so the detached thread can't outlive it
+	static Reactor& instance() {
+		static Reactor* reactor = new Reactor();
+		return *reactor;
+	}
+
+	Reactor(const Reactor&) = delete;
+	Reactor& operator=(const Reactor&) = delete;
+
+	// start delivering events for fd (should already be nonblocking)
+	bool add(int fd, ReactorHandler* handler) {
+		std::lock_guard<std::mutex> lock(handlersMutex);
+
+		if ((size_t)fd >= handlers.size()) {
+			handlers.resize(fd + 1, nullptr);
+		}
+		handlers[fd] = handler;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = fd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			perror("epoll_ctl");
+			handlers[fd] = nullptr;
+			return false;
+		}
+
+		return true;
+	}
+
+	// stop delivering events for fd, must not be called from a handler callback
+	void remove(int fd) {
+		std::lock_guard<std::mutex> lock(handlersMutex);
+		removeLocked(fd);
+	}
+
+	// ask for handler->onWake() on the reactor thread, safe from any thread
+	void schedule(int fd) {
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			pending.push_back(fd);
+		}
+
+		// only the first schedule since the last wakeup pays for the syscall
+		if (!woken.exchange(true)) {
+			uint64_t one = 1;
+			if (::write(wakefd, &one, sizeof one) == -1 && errno != EAGAIN) {
+				perror("eventfd write");
+			}
+		}
+	}
+
+private:
+	void removeLocked(int fd) {
+		if ((size_t)fd >= handlers.size() || !handlers[fd]) {
+			return;
+		}
+
+		handlers[fd] = nullptr;
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+	}
+
+	ReactorHandler* handlerFor(int fd) {
+		return (size_t)fd < handlers.size() ? handlers[fd] : nullptr;
+	}
+
+	void run() {
+		const int MAX_EVENTS = 128;
+		struct epoll_event events[MAX_EVENTS];
+		std::vector<int> woke;
+
+		while (true) {
+			int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+			if (n == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("epoll_wait");
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(handlersMutex);
+
+			for (int i = 0; i < n; i++) {
+				int fd = events[i].data.fd;
+
+				if (fd == wakefd) {
+					uint64_t count;
+					while (::read(wakefd, &count, sizeof count) > 0) {}
+
+					// clear before taking the list so a racing schedule() signals again
+					woken = false;
+
+					std::lock_guard<std::mutex> pendingLock(pendingMutex);
+					woke.insert(woke.end(), pending.begin(), pending.end());
+					pending.clear();
+					continue;
+				}
+
+				ReactorHandler* handler = handlerFor(fd);
+				if (handler && !handler->onEvents(events[i].events)) {
+					removeLocked(fd);
+				}
+			}
+
+			for (int fd : woke) {
+				ReactorHandler* handler = handlerFor(fd);
+				if (handler && !handler->onWake()) {
+					removeLocked(fd);
+				}
+			}
+			woke.clear();
+		}
+	}
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "Pool.hpp"
+
+// Fixed size byte ring a connection reads into with one big readv.
+// Frames are parsed straight out of it, only a trailing partial frame stays behind.
+class RecvBuffer {
+public:
+	enum : size_t { DEFAULT_CAPACITY = 64 * 1024 };
+
+private:
+	// default sized storage is recycled through a Pool, so a connection that gives its ring
+	// back after every burst costs a push and a pop on a thread local list, not a malloc
+	struct Ring {
+		uint8_t bytes[DEFAULT_CAPACITY];
+	};
+
+	uint8_t* data = nullptr; // taken on first use so idle sockets cost nothing
+	size_t capacity; // power of two
+	size_t head = 0; // first unread byte, both positions grow forever and get masked
+	size_t tail = 0; // one past the last byte written
+
+public:
+	explicit RecvBuffer(size_t capacity = DEFAULT_CAPACITY) : capacity(capacity) {}
+
+	~RecvBuffer() {
+		release();
+	}
+
+	RecvBuffer(const RecvBuffer&) = delete;
+	RecvBuffer& operator=(const RecvBuffer&) = delete;
+
+	size_t size() const {
+		return tail - head;
+	}
+
+	size_t space() const {
+		return capacity - size();
+	}
+
+	bool empty() const {
+		return head == tail;
+	}
+
+	// byte at offset from the read position, offset must be < size()
+	uint8_t peek(size_t offset) const {
+		return data[(head + offset) & (capacity - 1)];
+	}
+
+	// copy n bytes starting at offset from the read position, handles the wrap
+	void copyOut(size_t offset, void* out, size_t n) const {
+		size_t start = (head + offset) & (capacity - 1);
+		size_t first = std::min(n, capacity - start);
+		memcpy(out, data + start, first);
+		memcpy((uint8_t*)out + first, data, n - first);
+	}
+
+	void consume(size_t n) {
+		head += n;
+		if (head == tail) {
+			head = tail = 0; // keep the next read contiguous
+		}
+	}
+
+	// append up to n bytes from memory, returns how many fit
+	size_t append(const void* in, size_t n) {
+		allocate();
+
+		n = std::min(n, space());
+		size_t start = tail & (capacity - 1);
+		size_t first = std::min(n, capacity - start);
+		memcpy(data + start, in, first);
+		memcpy(data, (const uint8_t*)in + first, n - first);
+		tail += n;
+		return n;
+	}
+
+	// fill as much free space as possible with a single readv
+	// returns what readv returned, wanted is set to how many bytes were asked for
+	ssize_t readFrom(int fd, size_t& wanted) {
+		allocate();
+
+		struct iovec iov[2];
+		int count = 0;
+
+		size_t start = tail & (capacity - 1);
+		size_t free = space();
+		size_t first = std::min(free, capacity - start);
+		if (first > 0) {
+			iov[count].iov_base = data + start;
+			iov[count].iov_len = first;
+			count++;
+		}
+		if (free > first) {
+			iov[count].iov_base = data;
+			iov[count].iov_len = free - first;
+			count++;
+		}
+
+		wanted = free;
+		if (count == 0) {
+			errno = ENOBUFS;
+			return -1;
+		}
+
+		ssize_t n = ::readv(fd, iov, count);
+		if (n > 0) {
+			tail += n;
+		}
+		return n;
+	}
+
+	// give the storage back while nothing is buffered, an idle connection then holds no ring
+	void trim() {
+		if (empty()) {
+			release();
+		}
+	}
+
+private:
+	void allocate() {
+		if (data) {
+			return;
+		}
+		data = capacity == DEFAULT_CAPACITY ? Pool<Ring, 4, 4>::get()->bytes : new uint8_t[capacity];
+	}
+
+	void release() {
+		if (!data) {
+			return;
+		}
+		if (capacity == DEFAULT_CAPACITY) {
+			Pool<Ring, 4, 4>::put(reinterpret_cast<Ring*>(data));
+		} else {
+			delete[] data;
+		}
+		data = nullptr;
+	}
+};
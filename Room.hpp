@@ -0,0 +1,727 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <cstdint>
+
+#include "Capture.hpp"
+#include "Debug.hpp"
+#include "EntityStore.hpp"
+#include "Interest.hpp"
+#include "FixedStep.hpp"
+#include "History.hpp"
+#include "Input.hpp"
+#include "Priority.hpp"
+#include "Profiler.hpp"
+#include "Scheduler.hpp"
+#include "Snapshot.hpp"
+#include "SpatialGrid.hpp"
+#include "Socket.hpp"
+#include "UdpChannel.hpp"
+
+struct Client {
+	uint8_t id = 0; // assigned by the room on join
+	Socket sock;
+	std::unique_ptr<UdpConnection> udp; // made when the game starts
+	EntityHandle entity; // in game
+	uint32_t ackedSnapshot = 0; // newest snapshot tick the client confirmed, 0 for none
+	std::unique_ptr<SnapshotRing> sent; // what this client was sent, its possible baselines
+	InputBuffer inputs;
+	size_t snapshotBudget = UdpConnection::MAX_DATAGRAM - UdpConnection::HEADER_SIZE - 1; // bytes per snapshot, one whole datagram
+	bool varint = false; // we echoed FRAMING_VARINT, its TCP frames can be longer than a byte says
+	PriorityAccumulator priorities; // who goes first when a snapshot is over budget
+
+	typedef Protocol::Role Role;
+	Role role = Role::NONE;
+
+	Client(int fd) : sock(fd) {}
+	Client() {} // no connection, for replaying a capture
+};
+
+// One match: its players and their STAGING -> IN_GAME state machine.
+// Rooms share nothing and run as Scheduler tasks, stepping at SIM_RATE and sending
+// snapshots at NET_RATE while a game is starting or running. A staging room sleeps until
+// one of its sockets has something for it.
+// An idle room is a few hundred bytes plus its sockets, buffers are only held while in use.
+class Room : public Task, public Socket::Listener {
+public:
+	enum : size_t { MAX_PLAYERS = Protocol::MAX_PLAYERS };
+	enum : unsigned {
+		SIM_RATE = 60, // Hz
+		NET_RATE = 20,
+	};
+
+	static constexpr float GRID_CELL = 4.0f; // world units
+	static constexpr float CAPTURE_RADIUS = 1.5f;
+	static constexpr float PLAYER_SPEED = 6.0f; // world units per second at full stick
+	static constexpr float TAG_RADIUS = 2.0f;
+	static constexpr float SPAWN_SPACING = 2.0f; // between players on the same side
+	static constexpr float SPAWN_GAP = 12.0f; // between the robbers' side and the cops'
+	static constexpr unsigned VIEW_DELAY = 2 * SIM_RATE / NET_RATE; // clients render two snapshots behind
+	static constexpr unsigned MAX_REWIND = SIM_RATE / 4; // furthest back a tag is judged, in steps
+
+	// map bounds and snapshot precision: 1/128 of a unit across x and z, 1/64 vertically,
+	// velocities in 1/32 of a unit per second up to +-16
+	static SnapshotFormat snapshotFormat() {
+		return SnapshotFormat{
+			Quantizer(glm::vec3(-256.0f, -16.0f, -256.0f), glm::vec3(256.0f, 48.0f, 256.0f), glm::uvec3(16, 12, 16)),
+			Quantizer(glm::vec3(-16.0f), glm::vec3(16.0f), glm::uvec3(10)),
+		};
+	}
+
+	enum State {
+		STAGING,
+		IN_GAME,
+	};
+
+	Room(uint32_t id, UdpServer& udp, Scheduler& scheduler)
+		: id(id), udp(udp), scheduler(scheduler), closed(false), clock(SIM_RATE, NET_RATE),
+			entities(WorldSnapshot::MAX_ENTITIES), format(snapshotFormat()), grid(GRID_CELL) {}
+
+	Room(const Room&) = delete;
+	Room& operator=(const Room&) = delete;
+
+	uint32_t getId() const {
+		return id;
+	}
+
+	// takes the client if the room has space and hasn't started, otherwise leaves it alone
+	bool tryJoin(std::unique_ptr<Client>& client) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (closed || !joinable()) {
+				return false;
+			}
+			client->sock.setListener(this);
+			join(std::move(client));
+		}
+
+		// pick up anything the client sent after JOIN_ROOM
+		scheduler.wake(this);
+		return true;
+	}
+
+	// traffic of every connection in the room, summed and then one line each
+	void report(std::ostream& out) {
+		std::ostringstream s;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			TrafficStats total;
+			std::ostringstream lines;
+			for (auto& client : clients) {
+				TrafficStats stats = client->sock.stats();
+				total += stats;
+				lines << "  client " << (int)client->id << ": ";
+				stats.print(lines);
+				lines << "\n";
+			}
+			s << "room " << id << ", " << clients.size() << " clients: ";
+			total.print(s);
+			s << "\n" << lines.str();
+		}
+		out << s.str() << std::flush;
+	}
+
+	// everyone left and the scheduler is done with it, the server can delete the room
+	bool finished() const {
+		return closed && isIdle();
+	}
+
+	Clock::time_point run(Clock::time_point deadline) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (closed) {
+			return idle();
+		}
+
+		// simulated time only passes while we're on the clock, a woken staging room steps nothing
+		unsigned steps = 0;
+		if (ticking) {
+			steps = clock.advance(deadline);
+		} else {
+			clock.reset(deadline);
+		}
+
+		runSteps(steps);
+		if (closed || !ticking) {
+			return idle(); // nothing to do until someone says something
+		}
+		return clock.next(deadline, Clock::now());
+	}
+
+	// a run of exactly steps, whatever the clock says, for replaying a capture
+	void replay(unsigned steps) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!closed) {
+			runSteps(steps);
+		}
+	}
+
+	// FNV-1a over the game state, equal after a replay only if every step came out the same
+	uint64_t stateHash() {
+		std::lock_guard<std::mutex> lock(mutex);
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&hash](const void* data, size_t size) {
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			for (size_t i = 0; i < size; i++) {
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+		};
+
+		mix(&state, sizeof state);
+		mix(&simTick, sizeof simTick);
+		mix(&stagingState.starting, sizeof stagingState.starting);
+		mix(&stagingState.startingTimer, sizeof stagingState.startingTimer);
+		for (auto& client : clients) {
+			mix(&client->id, sizeof client->id);
+			mix(&client->role, sizeof client->role);
+			mix(&client->ackedSnapshot, sizeof client->ackedSnapshot);
+		}
+		for (size_t i = 0; i < entities.size(); i++) {
+			uint32_t slot = entities.slotOf(i);
+			mix(&slot, sizeof slot);
+			mix(&entities.position[i], 3 * sizeof(float)); // w is padding
+			mix(&entities.velocity[i], 3 * sizeof(float));
+			mix(&entities.orientation[i], sizeof entities.orientation[i]);
+			mix(&entities.role[i], 1);
+			mix(&entities.flags[i], 1);
+		}
+		return hash;
+	}
+
+	void onSocketActivity() override {
+		scheduler.wake(this);
+	}
+
+private:
+	struct StagingState {
+		bool starting = false;
+		float startingTimer = 0.0f;
+		Client* robber = nullptr; // everyone else assumed to be cop
+		unsigned playerUnready = 0;
+	};
+
+	uint32_t id;
+	UdpServer& udp;
+	Scheduler& scheduler;
+
+	std::mutex mutex; // held by run() and tryJoin(), everything below is under it
+	std::atomic<bool> closed;
+	std::vector<std::unique_ptr<Client>> clients;
+	State state = STAGING;
+	StagingState stagingState;
+	uint8_t nextClientId = 0; // ids aren't reused, so a leaver's id never points at someone new
+	FixedStep clock;
+	uint32_t simTick = 0; // simulation steps since the game started
+	EntityStore entities; // players and everything else in the world
+	SnapshotFormat format;
+	WorldSnapshot captured; // scratch for copying entities into snapshots at NET_RATE
+	SpatialGrid grid; // rebuilt from entities every step
+	std::vector<uint32_t> robbers; // scratch for checkCaptures
+	TransformHistory history; // recent steps, for lag compensated tags
+	std::vector<Client*> taggers; // cops that pressed TAG this step
+	std::vector<PastTransform> rewound; // scratch for checkTags
+	WorldSnapshot view; // scratch for one client's filtered snapshot
+	std::vector<float> weights; // scratch, view's priority weights by slot
+	uint32_t netTick = 0; // snapshots sent
+	bool ticking = false; // last run asked for another, so the time since then counts
+	Capture::Buffer capture; // this room's records while --record is on
+
+	// a run's work, for run() on the clock and replay() from a capture alike
+	void runSteps(unsigned steps) {
+		Profiler::begin();
+		tick(steps);
+		Profiler::end(id, steps, clients.size(), entities.size());
+
+		if (Capture::enabled()) {
+			capture.run(id, steps);
+		}
+
+		if (clients.empty()) {
+			closed = true;
+			return;
+		}
+		ticking = state == IN_GAME || stagingState.starting;
+	}
+
+	bool joinable() const {
+		return state == STAGING && !stagingState.starting && clients.size() < MAX_PLAYERS;
+	}
+
+	void join(std::unique_ptr<Client> client) {
+		client->id = nextClientId++;
+		if (Capture::enabled()) {
+			capture.join(id, client->id);
+		}
+
+		client->sock.writeQueue.enqueue(Packet::pack(MessageType::JOIN_ROOM, {
+			uint8_t(id), uint8_t(id >> 8), uint8_t(id >> 16), uint8_t(id >> 24)
+		}));
+
+		broadcast(Packet::pack(MessageType::STAGING_PLAYER_CONNECT, {client->id}));
+
+		std::vector<uint8_t> syncData;
+		syncData.push_back(client->id);
+		for (auto& other : clients) {
+			syncData.push_back(other->id);
+			syncData.push_back(other->role);
+		}
+
+		client->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_PLAYER_SYNC, syncData));
+
+		stagingState.playerUnready += 1;
+		clients.push_back(std::move(client));
+
+		// TODO: tell new client about game settings / staging state
+	}
+
+	void tick(unsigned steps) {
+		removeDisconnected();
+
+		switch (state) {
+			case STAGING: {
+				tickStaging(steps);
+				break;
+			}
+
+			case IN_GAME: {
+				tickInGame(steps);
+				break;
+			}
+		}
+	}
+
+	// encode once, every client's write queue shares the same packet
+	void broadcast(Packet* packet) {
+		for (auto& c : clients) {
+			c->sock.writeQueue.enqueue(packet->retain());
+		}
+		packet->release();
+	}
+
+	// robbers line up on one side and cops on the other, out of each other's reach
+	static glm::aligned_vec4 spawnPoint(Client::Role role, uint32_t slot) {
+		float side = role == Client::Role::ROBBER ? SPAWN_GAP / 2 : -SPAWN_GAP / 2;
+		return glm::aligned_vec4(side, 0.0f, SPAWN_SPACING * slot, 0.0f);
+	}
+
+	// the game's outcome can't ride on a snapshot that may be lost, send it until it's acked
+	void announceCapture(uint32_t robber) {
+		Packet* packet = Packet::pack(MessageType::ROBBER_CAPTURED, {uint8_t(entities.slotOf(robber))});
+		for (auto& c : clients) {
+			if (c->udp->ready()) {
+				c->udp->sendReliable(packet->retain());
+			} else {
+				c->sock.writeQueue.enqueue(packet->retain());
+			}
+		}
+		packet->release();
+	}
+
+	void removeDisconnected() {
+		auto gone = std::partition(clients.begin(), clients.end(), [](const std::unique_ptr<Client>& c) {
+			return c->sock.isConnected();
+		});
+		if (gone == clients.end()) {
+			return;
+		}
+
+		// destroying them closes their sockets and UDP routes
+		std::vector<std::unique_ptr<Client>> leaving;
+		std::move(gone, clients.end(), std::back_inserter(leaving));
+		clients.erase(gone, clients.end());
+
+		for (auto& client : leaving) {
+			std::cout << "Client " << (int)client->id << " left room " << id << std::endl;
+			if (Capture::enabled()) {
+				capture.leave(id, client->id);
+			}
+
+			if (state == STAGING) {
+				if (stagingState.robber == client.get()) {
+					stagingState.robber = nullptr;
+				}
+				if (client->role == Client::Role::NONE) {
+					stagingState.playerUnready -= 1;
+				}
+				broadcast(Packet::pack(MessageType::STAGING_PLAYER_DISCONNECT, {client->id}));
+			} else {
+				entities.destroy(client->entity);
+			}
+		}
+
+		// not enough players left to start
+		if (state == STAGING && stagingState.starting && clients.size() < 2) {
+			stagingState.starting = false;
+		}
+	}
+
+	void tickStaging(unsigned steps) {
+		for (auto& client : clients) {
+			// read pending messages from clients
+			Packet* out;
+			while (client->sock.readQueue.try_dequeue(out)) {
+				if (!out) {
+					std::cout << "Bad packet from client" << std::endl;
+					continue;
+				}
+
+				if (Capture::enabled()) {
+					capture.frame(id, client->id, out->payload);
+				}
+
+				Profiler::Message timer(out->payload.at(0));
+				MessageLatency::Handling handling(out->stamp, out->payload.at(0)); // replies carry its recv stamp
+				switch (out->payload.at(0)) { // message type
+					case MessageType::STAGING_VOTE_TO_START: {
+						if (stagingState.starting) {
+							break;
+						}
+
+						if (clients.size() < 2) {
+							break;
+						}
+
+						if (stagingState.playerUnready > 0) {
+							// TODO: error message saying not all players are ready
+							break;
+						}
+
+						stagingState.starting = true;
+						stagingState.startingTimer = 0.0f;
+						IF_DEBUG(stagingState.startingTimer = 3.0f);
+
+						std::cout << "Client voted to start the game" << std::endl;
+
+						// TODO: queue up message saying player voted to start the game
+						// or do it now?
+						broadcast(Packet::pack(MessageType::STAGING_VOTE_TO_START, {client->id}));
+
+						break;
+					}
+
+					case MessageType::STAGING_VETO_START: {
+						if (!stagingState.starting) {
+							break;
+						}
+
+						stagingState.starting = false;
+
+						std::cout << "Client vetoed the game start" << std::endl;
+
+						// TODO: queue up message start vetod by x message
+						// or do it now?
+						broadcast(Packet::pack(MessageType::STAGING_VETO_START, {client->id}));
+
+						break;
+					}
+
+					case MessageType::STAGING_ROLE_CHANGE: {
+						if (stagingState.starting) {
+							break;
+						}
+
+						// only a real role can be picked, NONE would undo the player's ready count
+						if (out->payload.size() < 2 || (out->payload[1] != Client::Role::ROBBER && out->payload[1] != Client::Role::COP)) {
+							std::cout << "Bad role change from client " << (int)client->id << std::endl;
+							break;
+						}
+
+						DEBUG_PRINT("client " << (int)client->id << " wants role " << int(out->payload[1]));
+
+						if (out->payload[1] == Client::Role::ROBBER && stagingState.robber) { // can't be robber if someone else is
+							client->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_ROLE_CHANGE_REJECTION, {stagingState.robber->id}));
+							break;
+						}
+
+						if (client->role == Client::Role::NONE) { // client has never selected anything
+							stagingState.playerUnready -= 1;
+						}
+
+						// client is no longer robber
+						if (client->role == Client::Role::ROBBER && out->payload[1] != Client::Role::ROBBER) {
+							stagingState.robber = nullptr;
+						}
+
+						if (out->payload[1] == Client::Role::ROBBER) { // desires to be robber
+							stagingState.robber = client.get();
+						}
+
+						client->role = static_cast<Client::Role>(out->payload[1]);
+
+						// tell players of role change
+						broadcast(Packet::pack(MessageType::STAGING_ROLE_CHANGE, {client->id, out->payload[1]}));
+
+						break;
+					}
+
+					case MessageType::FRAMING_VARINT: {
+						// echo it back, frames after the echo use varint headers
+						client->sock.writeQueue.enqueue(Packet::pack(MessageType::FRAMING_VARINT));
+						client->varint = true;
+						break;
+					}
+
+					default: {
+						std::cout << "Unknown starting message type: " << (int)out->payload.at(0) << std::endl;
+						break;
+					}
+				}
+
+				out->release();
+			}
+		}
+
+		for (unsigned i = 0; i < steps && stagingState.starting; i++) {
+			stagingState.startingTimer += clock.dt();
+
+			if (stagingState.startingTimer > 5.0f) {
+				startGame();
+				break;
+			}
+		}
+
+		// write state updates
+	}
+
+	void startGame() {
+		std::cout << "Game starting in room " << id << ". Leaving staging." << std::endl;
+		IF_DEBUG(for (auto& c : clients) {
+			TrafficStats stats = c->sock.stats();
+			DEBUG_PRINT("client " << (int)c->id << " staging writes: " << stats.framesOut << " frames in " << stats.sendCalls << " writes, largest batch " << stats.largestBatch);
+		});
+
+		// UDP is only needed in game, staging rooms don't hold a route or its buffers
+		for (auto& client : clients) {
+			client->entity = entities.create();
+			uint32_t i = entities.index(client->entity);
+			entities.position[i] = spawnPoint(client->role, client->entity.slot);
+			entities.role[i] = client->role;
+
+			client->udp.reset(udp.connect());
+			uint32_t token = client->udp->getToken();
+			client->sock.writeQueue.enqueue(Packet::pack(MessageType::UDP_TOKEN, {
+				uint8_t(token), uint8_t(token >> 8), uint8_t(token >> 16), uint8_t(token >> 24)
+			}));
+		}
+
+		for (auto& client : clients) {
+			client->sent.reset(new SnapshotRing());
+		}
+
+		broadcast(Packet::pack(MessageType::STAGING_START_GAME, { 200 }));
+		state = IN_GAME;
+	}
+
+	void tickInGame(unsigned steps) {
+		auto now = std::chrono::steady_clock::now();
+
+		for (auto& client : clients) {
+			// read pending messages from clients, over TCP and UDP alike
+			std::vector<Packet*> messages;
+			{
+				Profiler::Scope timer(Profiler::DRAIN);
+				Packet* packet;
+				while (client->sock.readQueue.try_dequeue(packet)) {
+					messages.push_back(packet);
+				}
+				client->udp->receive(now, messages);
+			}
+
+			for (Packet* out : messages) {
+				if (!out) {
+					std::cout << "Bad packet from client" << std::endl;
+					continue;
+				}
+
+				if (Capture::enabled()) {
+					capture.frame(id, client->id, out->payload);
+				}
+
+				Profiler::Message timer(out->payload.at(0));
+				MessageLatency::Handling handling(out->stamp, out->payload.at(0));
+
+				switch (out->payload.at(0)) { // message type
+					case MessageType::INPUT: {
+						client->inputs.pushFrame(out->payload);
+						break;
+					}
+
+					case MessageType::SNAPSHOT_ACK: {
+						if (out->payload.size() < 5) {
+							break;
+						}
+						uint32_t acked = out->payload[1] | out->payload[2] << 8 | out->payload[3] << 16 | uint32_t(out->payload[4]) << 24;
+
+						// acks arrive out of order over UDP, only ever move forward
+						if (acked <= simTick && acked > client->ackedSnapshot) {
+							client->ackedSnapshot = acked;
+						}
+						break;
+					}
+
+					case MessageType::FRAMING_VARINT: {
+						client->sock.writeQueue.enqueue(Packet::pack(MessageType::FRAMING_VARINT));
+						client->varint = true;
+						break;
+					}
+
+					default: {
+						std::cout << "Unknown game message type: " << (int)out->payload[0] << std::endl;
+						break;
+					}
+				}
+
+				out->release();
+			}
+		}
+
+		for (unsigned i = 0; i < steps; i++) {
+			{
+				Profiler::Scope timer(Profiler::SIMULATE);
+				applyInputs();
+				entities.integrate(clock.dt());
+				grid.build(entities.position);
+				checkCaptures();
+				checkTags();
+				simTick++;
+				history.record(entities, simTick);
+			}
+
+			if (clock.stepNet()) {
+				sendSnapshot(now);
+			}
+		}
+	}
+
+	// one buffered command per client per step
+	void applyInputs() {
+		taggers.clear();
+		for (auto& client : clients) {
+			InputCommand command = client->inputs.next();
+			if (!entities.alive(client->entity)) {
+				continue;
+			}
+
+			if (command.buttons & InputCommand::TAG && client->role == Client::Role::COP) {
+				taggers.push_back(client.get());
+			}
+
+			uint32_t i = entities.index(client->entity);
+			if (entities.flags[i] & EntityStore::FROZEN) {
+				continue; // caught, input still drains so it resumes cleanly
+			}
+			glm::vec3 move(command.moveX, 0.0f, command.moveZ);
+			float length = glm::length(move);
+			if (length > 127.0f) {
+				move *= 127.0f / length; // diagonals aren't faster
+			}
+			move *= PLAYER_SPEED / 127.0f;
+
+			entities.velocity[i] = glm::aligned_vec4(move.x, 0.0f, move.z, 0.0f);
+			entities.orientation[i] = glm::angleAxis(command.yaw * (glm::two_pi<float>() / 65536.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		}
+	}
+
+	// every free robber against whoever is near it, in one pass over the grid
+	void checkCaptures() {
+		robbers.clear();
+		for (uint32_t i = 0; i < entities.size(); i++) {
+			if (entities.role[i] == Client::Role::ROBBER && !(entities.flags[i] & EntityStore::CAPTURED)) {
+				robbers.push_back(i);
+			}
+		}
+
+		grid.around(robbers, CAPTURE_RADIUS, [this](uint32_t robber, uint32_t other) {
+			if (entities.role[other] != Client::Role::COP || entities.flags[robber] & EntityStore::CAPTURED) {
+				return;
+			}
+
+			entities.flags[robber] |= EntityStore::CAPTURED | EntityStore::FROZEN;
+			entities.velocity[robber] = glm::aligned_vec4(0.0f);
+			std::cout << "Robber captured in room " << id << std::endl;
+			announceCapture(robber);
+		});
+	}
+
+	// a cop's tag lands if a robber was within reach on the cop's screen, that is where it was
+	// VIEW_DELAY steps before the newest snapshot the cop acked, but never further back than MAX_REWIND
+	void checkTags() {
+		for (Client* cop : taggers) {
+			uint32_t view = cop->ackedSnapshot > VIEW_DELAY ? cop->ackedSnapshot - VIEW_DELAY : 0;
+			if (simTick - view > MAX_REWIND) {
+				view = simTick > MAX_REWIND ? simTick - MAX_REWIND : 0;
+			}
+			if (!history.rewind(std::max(view, history.oldest()), rewound)) {
+				continue;
+			}
+
+			// the cop is where it is now, its own movement is predicted on its machine
+			glm::vec3 reach(entities.position[entities.index(cop->entity)]);
+			TransformHistory::radius(rewound, reach, TAG_RADIUS, [this](const PastTransform& past, float) {
+				if (past.role != Client::Role::ROBBER || past.flags & EntityStore::CAPTURED) {
+					return;
+				}
+
+				for (uint32_t robber : robbers) {
+					if (entities.slotOf(robber) == past.slot && !(entities.flags[robber] & EntityStore::CAPTURED)) {
+						entities.flags[robber] |= EntityStore::CAPTURED | EntityStore::FROZEN;
+						entities.velocity[robber] = glm::aligned_vec4(0.0f);
+						std::cout << "Robber tagged in room " << id << std::endl;
+						announceCapture(robber);
+					}
+				}
+			});
+		}
+	}
+
+	// write state updates, unreliable over UDP once the client has said hello there
+	// each client gets a delta from the last snapshot it acked, or everything if that's too old,
+	// of the part of the world Interest lets it see
+	void sendSnapshot(Clock::time_point now) {
+		{
+			Profiler::Scope timer(Profiler::ENCODE);
+			captured.capture(entities, simTick, format);
+		}
+		netTick++;
+
+		for (auto& client : clients) {
+			Packet* packet = Packet::acquire();
+			{
+				Profiler::Scope timer(Profiler::ENCODE);
+				const WorldSnapshot* baseline = client->sent->find(client->ackedSnapshot);
+
+				// only what this client is allowed and needs to see, as much of it as fits its budget
+				if (entities.alive(client->entity)) {
+					Interest::filter(captured, entities, grid, entities.index(client->entity), baseline, netTick, view, weights);
+				} else {
+					Interest::unseen(captured, view, weights);
+				}
+				// until UDP is up snapshots go over TCP, in one legacy frame if that's all the client speaks
+				size_t budget = client->snapshotBudget;
+				if (!client->udp->ready() && !client->varint) {
+					budget = std::min<size_t>(budget, FrameHeader::LEGACY_MAX_PAYLOAD);
+				}
+				client->priorities.fit(view, baseline, weights, budget, format);
+				const WorldSnapshot* current = &client->sent->push(view);
+
+				SnapshotEncoder::encode(MessageType::SNAPSHOT, *current, baseline, client->inputs.acked(), format, packet->payload);
+				packet->header = packet->payload.size();
+			}
+
+			Profiler::Scope timer(Profiler::ENQUEUE);
+			if (client->udp->ready()) {
+				client->udp->sendUnreliable(packet, now);
+			} else {
+				client->sock.writeQueue.enqueue(packet);
+			}
+			client->udp->flush(now);
+		}
+	}
+};
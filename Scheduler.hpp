@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+#include <sys/prctl.h>
+
+// Something the Scheduler runs at deadlines, a Room for instance.
+class Task {
+	friend class Scheduler;
+
+	enum State : int {
+		IDLE, // not in the heap, waiting for wake()
+		SCHEDULED, // in the heap or running
+		NOTIFIED, // scheduled, and woken again since it started running
+	};
+
+	std::atomic<int> state;
+
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// return value of run() for "leave me alone until someone calls wake()"
+	static Clock::time_point idle() {
+		return Clock::time_point::max();
+	}
+
+	Task() : state(IDLE) {}
+	virtual ~Task() {}
+
+	// deadline is when this run was due, returns when the next one is due (or idle())
+	// never runs on two threads at once
+	virtual Clock::time_point run(Clock::time_point deadline) = 0;
+
+	// not scheduled and nothing can wake it, so it can be deleted
+	bool isIdle() const {
+		return state.load() == IDLE;
+	}
+};
+
+// Runs many Tasks on a fixed pool of worker threads, earliest deadline first.
+// Tasks that return idle() cost nothing until wake() is called on them, so a room
+// nobody is talking to never gets ticked.
+// Workers sleep until just short of a deadline and spin the rest, plain sleeps overshoot
+// by up to a millisecond which is most of the slack a 60Hz tick has.
+class Scheduler {
+
+	struct Entry {
+		Task::Clock::time_point deadline;
+		Task* task;
+
+		bool operator>(const Entry& other) const {
+			return deadline > other.deadline;
+		}
+	};
+
+	std::mutex mutex;
+	std::condition_variable changed; // something was pushed, or we're shutting down
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+	bool running = true;
+
+	std::vector<std::thread> workers;
+
+	std::atomic<uint64_t> ticks;
+	std::atomic<uint64_t> lateTicks;
+	std::atomic<uint64_t> totalLatenessUs;
+	std::atomic<uint64_t> maxLatenessUs;
+
+public:
+	enum : uint64_t {
+		LATE_US = 1000, // a run more than this past its deadline counts as late
+		SPIN_US = 200, // how long before a deadline a worker stops sleeping
+	};
+
+	// how far behind deadlines runs are starting
+	struct Stats {
+		uint64_t ticks = 0;
+		uint64_t lateTicks = 0;
+		uint64_t totalLatenessUs = 0;
+		uint64_t maxLatenessUs = 0;
+	};
+
+	// threads == 0 picks one per core
+	explicit Scheduler(unsigned threads = 0) : ticks(0), lateTicks(0), totalLatenessUs(0), maxLatenessUs(0) {
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (unsigned i = 0; i < threads; i++) {
+			workers.emplace_back([this]() { work(); });
+		}
+	}
+
+	// no workers, woken tasks just wait in the heap while their owner runs them by hand,
+	// for replaying a capture
+	struct Paused {};
+	explicit Scheduler(Paused) : ticks(0), lateTicks(0), totalLatenessUs(0), maxLatenessUs(0) {}
+
+	~Scheduler() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		changed.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(const Scheduler&) = delete;
+
+	// run task now, or again right after its current run if it is already going
+	// safe from any thread, cheap when the task is already scheduled
+	void wake(Task* task) {
+		int state = task->state.load();
+		while (true) {
+			if (state == Task::NOTIFIED) {
+				return;
+			}
+
+			int next = state == Task::IDLE ? Task::SCHEDULED : Task::NOTIFIED;
+			if (task->state.compare_exchange_weak(state, next)) {
+				break;
+			}
+		}
+
+		if (state == Task::IDLE) {
+			push(task, Task::Clock::now());
+		}
+	}
+
+	size_t threads() const {
+		return workers.size();
+	}
+
+	Stats stats() const {
+		Stats s;
+		s.ticks = ticks.load(std::memory_order_relaxed);
+		s.lateTicks = lateTicks.load(std::memory_order_relaxed);
+		s.totalLatenessUs = totalLatenessUs.load(std::memory_order_relaxed);
+		s.maxLatenessUs = maxLatenessUs.load(std::memory_order_relaxed);
+		return s;
+	}
+
+private:
+	void push(Task* task, Task::Clock::time_point deadline) {
+		bool earliest;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			earliest = heap.empty() || deadline < heap.top().deadline;
+			heap.push(Entry{deadline, task});
+		}
+		// a later deadline can wait for whichever worker is already sleeping on the top
+		if (earliest) {
+			changed.notify_one();
+		}
+	}
+
+	void record(Task::Clock::duration lateness) {
+		uint64_t us = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(lateness).count());
+
+		ticks.fetch_add(1, std::memory_order_relaxed);
+		totalLatenessUs.fetch_add(us, std::memory_order_relaxed);
+		if (us > LATE_US) {
+			lateTicks.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		uint64_t max = maxLatenessUs.load(std::memory_order_relaxed);
+		while (us > max && !maxLatenessUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+	}
+
+	void work() {
+		// the default 50us of timer slack would eat into SPIN_US
+		if (prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0) == -1) {
+			perror("prctl");
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (running) {
+			if (heap.empty()) {
+				changed.wait(lock);
+				continue;
+			}
+
+			Entry entry = heap.top();
+			Task::Clock::time_point wakeAt = entry.deadline - std::chrono::microseconds(SPIN_US);
+			if (wakeAt > Task::Clock::now()) {
+				changed.wait_until(lock, wakeAt);
+				continue;
+			}
+			heap.pop();
+
+			// another worker may be sleeping on a deadline that's now at the top
+			if (!heap.empty()) {
+				changed.notify_one();
+			}
+			lock.unlock();
+
+			while (Task::Clock::now() < entry.deadline) {
+				std::this_thread::yield();
+			}
+
+			Task* task = entry.task;
+			record(Task::Clock::now() - entry.deadline);
+
+			// wakes from here on are for messages this run might miss
+			task->state.store(Task::SCHEDULED);
+			Task::Clock::time_point next = task->run(entry.deadline);
+
+			if (next == Task::idle()) {
+				int expected = Task::SCHEDULED;
+				if (!task->state.compare_exchange_strong(expected, Task::IDLE)) {
+					// woken while running, go again
+					task->state.store(Task::SCHEDULED);
+					push(task, Task::Clock::now());
+				}
+				// once IDLE the task may be deleted, don't touch it again
+			} else {
+				task->state.store(Task::SCHEDULED);
+				push(task, next);
+			}
+
+			lock.lock();
+		}
+	}
+};
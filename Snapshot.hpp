@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+#include "BitStream.hpp"
+#include "EntityStore.hpp"
+#include "Quantize.hpp"
+
+// What a client sees of one entity, already quantized to what goes on the wire
+struct EntityState {
+	glm::uvec3 position = glm::uvec3(0); // SnapshotFormat::position steps
+	glm::uvec3 velocity = glm::uvec3(0); // SnapshotFormat::velocity steps
+	uint32_t orientation = 0; // SmallestThree
+	uint8_t role = 0;
+	uint8_t flags = 0;
+	uint32_t generation = 0; // not sent, a different one in the same slot is a new entity
+	bool present = false;
+};
+
+// How a room's snapshots are quantized, the client needs the same numbers to decode them
+struct SnapshotFormat {
+	Quantizer position;
+	Quantizer velocity;
+};
+
+// The world as of one simulation tick, indexed by EntityStore slot
+struct WorldSnapshot {
+	enum : size_t { MAX_ENTITIES = 1024 };
+
+	uint32_t tick = 0; // 0 means no snapshot
+	std::vector<EntityState> entities; // up to the highest slot in use
+
+	bool has(size_t slot) const {
+		return slot < entities.size() && entities[slot].present;
+	}
+
+	size_t used() const {
+		return entities.size();
+	}
+
+	// copy out of the store, quantizing on the way, reusing our own storage
+	void capture(const EntityStore& store, uint32_t captureTick, const SnapshotFormat& format) {
+		tick = captureTick;
+
+		// the whole store in one pass per field
+		format.position.quantize(store.position, positions);
+		format.velocity.quantize(store.velocity, velocities);
+
+		size_t highest = 0;
+		for (size_t i = 0; i < store.size(); i++) {
+			highest = std::max<size_t>(highest, store.slotOf(i) + 1);
+		}
+		entities.assign(highest, EntityState());
+
+		for (size_t i = 0; i < store.size(); i++) {
+			EntityState& e = entities[store.slotOf(i)];
+			e.position = glm::uvec3(positions[i]);
+			e.velocity = glm::uvec3(velocities[i]);
+			e.orientation = SmallestThree::pack(store.orientation[i]);
+			e.role = store.role[i];
+			e.flags = store.flags[i];
+			e.generation = store.generationOf(i);
+			e.present = true;
+		}
+	}
+
+private:
+	std::vector<glm::uvec4> positions; // capture scratch, by dense index
+	std::vector<glm::uvec4> velocities;
+};
+
+// The last RING_SIZE snapshots of a room, the baselines deltas can be taken against.
+// Clients that fall further behind than that get a full snapshot.
+class SnapshotRing {
+public:
+	enum : size_t { RING_SIZE = 32 }; // 1.6s at 20Hz
+
+	SnapshotRing() : ring(new WorldSnapshot[RING_SIZE]) {}
+
+	// keeps a copy, overwriting the one RING_SIZE ticks older
+	const WorldSnapshot& push(const WorldSnapshot& snapshot) {
+		WorldSnapshot& slot = ring[snapshot.tick % RING_SIZE];
+		slot.tick = snapshot.tick;
+		slot.entities = snapshot.entities; // not the capture scratch
+		return slot;
+	}
+
+	// nullptr once overwritten
+	const WorldSnapshot* find(uint32_t tick) const {
+		if (tick == 0) {
+			return nullptr;
+		}
+		const WorldSnapshot& slot = ring[tick % RING_SIZE];
+		return slot.tick == tick ? &slot : nullptr;
+	}
+
+private:
+	std::unique_ptr<WorldSnapshot[]> ring;
+};
+
+// SNAPSHOT payload, starting with bytes, little endian:
+//   u8 type, u32 tick, u32 baseline tick (0 for a full snapshot), u32 newest INPUT sequence
+//   applied for this client, u16 slot count N,
+// then a bit stream (BitWriter order) with, for each of the N slots, a changed bit and if set
+// 6 field bits and the fields they name in bit order. A changed slot without PRESENT was removed.
+//   POSITION: 2 bits of DeltaSize, then signed steps per axis from the baseline position at
+//     that width, or for ABSOLUTE the position at SnapshotFormat::position widths
+//   VELOCITY: SnapshotFormat::velocity widths
+//   ORIENTATION: SmallestThree::PACKED_BITS
+//   ROLE, FLAGS: 8 bits each
+// Slots missing from the baseline, or holding a different entity there, are sent with every field.
+// A player running and turning, acked within a snapshot or two, costs 62 bits.
+struct SnapshotEncoder {
+	enum Field : uint8_t {
+		PRESENT = 1 << 0,
+		POSITION = 1 << 1,
+		VELOCITY = 1 << 2,
+		ORIENTATION = 1 << 3,
+		ROLE = 1 << 4,
+		FLAGS = 1 << 5,
+		ALL = 0x3f,
+	};
+
+	enum : unsigned { FIELD_BITS = 6 };
+	enum : size_t { HEADER_SIZE = 15 }; // bytes before the bit stream
+
+	// smallest that fits every axis, at the default position format a step is 1/128 of a unit
+	enum DeltaSize : uint8_t {
+		DELTA_5, // +-15 steps
+		DELTA_9, // +-255
+		DELTA_13, // +-4095
+		ABSOLUTE,
+	};
+
+	// append current, as a delta from baseline (nullptr for a full snapshot), to out
+	static void encode(uint8_t type, const WorldSnapshot& current, const WorldSnapshot* baseline, uint32_t ackedInput,
+			const SnapshotFormat& format, std::vector<uint8_t>& out) {
+		out.push_back(type);
+		putU32(out, current.tick);
+		putU32(out, baseline ? baseline->tick : 0);
+		putU32(out, ackedInput);
+
+		size_t count = std::max(current.used(), baseline ? baseline->used() : 0);
+		out.push_back(count);
+		out.push_back(count >> 8);
+
+		BitWriter bits(out);
+		const glm::uvec3& positionBits = format.position.getBits();
+		const glm::uvec3& velocityBits = format.velocity.getBits();
+
+		for (size_t slot = 0; slot < count; slot++) {
+			uint8_t fields = diff(current, baseline, slot);
+			bool changed = isChanged(current, baseline, slot, fields);
+			bits.writeBool(changed);
+			if (!changed) {
+				continue;
+			}
+			bits.write(fields, FIELD_BITS);
+
+			const EntityState& e = current.entities[slot];
+			if (fields & POSITION) {
+				glm::ivec3 delta;
+				DeltaSize size = fields == ALL ? ABSOLUTE : deltaSize(e.position, baseline->entities[slot].position, delta);
+				bits.write(size, 2);
+				for (int axis = 0; axis < 3; axis++) {
+					if (size == ABSOLUTE) {
+						bits.write(e.position[axis], positionBits[axis]);
+					} else {
+						bits.writeSigned(delta[axis], deltaBits(size));
+					}
+				}
+			}
+			if (fields & VELOCITY) {
+				for (int axis = 0; axis < 3; axis++) {
+					bits.write(e.velocity[axis], velocityBits[axis]);
+				}
+			}
+			if (fields & ORIENTATION) {
+				bits.write(e.orientation, SmallestThree::PACKED_BITS);
+			}
+			if (fields & ROLE) {
+				bits.write(e.role, 8);
+			}
+			if (fields & FLAGS) {
+				bits.write(e.flags, 8);
+			}
+		}
+	}
+
+	// what slot costs in encode() past its changed bit, 0 if it's unchanged
+	static size_t slotBits(const WorldSnapshot& current, const WorldSnapshot* baseline, size_t slot, const SnapshotFormat& format) {
+		uint8_t fields = diff(current, baseline, slot);
+		if (!isChanged(current, baseline, slot, fields)) {
+			return 0;
+		}
+
+		size_t bits = FIELD_BITS;
+		if (fields & POSITION) {
+			glm::ivec3 delta;
+			DeltaSize size = fields == ALL ? ABSOLUTE : deltaSize(current.entities[slot].position, baseline->entities[slot].position, delta);
+			const glm::uvec3& positionBits = format.position.getBits();
+			bits += 2 + (size == ABSOLUTE ? positionBits.x + positionBits.y + positionBits.z : 3 * deltaBits(size));
+		}
+		if (fields & VELOCITY) {
+			const glm::uvec3& velocityBits = format.velocity.getBits();
+			bits += velocityBits.x + velocityBits.y + velocityBits.z;
+		}
+		if (fields & ORIENTATION) {
+			bits += SmallestThree::PACKED_BITS;
+		}
+		if (fields & ROLE) {
+			bits += 8;
+		}
+		if (fields & FLAGS) {
+			bits += 8;
+		}
+		return bits;
+	}
+
+private:
+	// anything to send for slot, fields from diff()
+	static bool isChanged(const WorldSnapshot& current, const WorldSnapshot* baseline, size_t slot, uint8_t fields) {
+		return fields != 0 || (baseline && baseline->has(slot) != current.has(slot));
+	}
+
+	// field bits for slot, 0 for a slot that's gone or didn't change
+	static uint8_t diff(const WorldSnapshot& current, const WorldSnapshot* baseline, size_t slot) {
+		if (!current.has(slot)) {
+			return 0;
+		}
+		if (!baseline || !baseline->has(slot)) {
+			return ALL;
+		}
+
+		const EntityState& now = current.entities[slot];
+		const EntityState& then = baseline->entities[slot];
+		if (now.generation != then.generation) {
+			return ALL;
+		}
+
+		uint8_t fields = 0;
+		if (now.position != then.position) {
+			fields |= POSITION;
+		}
+		if (now.velocity != then.velocity) {
+			fields |= VELOCITY;
+		}
+		if (now.orientation != then.orientation) {
+			fields |= ORIENTATION;
+		}
+		if (now.role != then.role) {
+			fields |= ROLE;
+		}
+		if (now.flags != then.flags) {
+			fields |= FLAGS;
+		}
+		return fields ? fields | PRESENT : 0;
+	}
+
+	static unsigned deltaBits(DeltaSize size) {
+		return 5 + 4 * size;
+	}
+
+	static DeltaSize deltaSize(const glm::uvec3& now, const glm::uvec3& then, glm::ivec3& delta) {
+		int32_t largest = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			delta[axis] = int32_t(now[axis]) - int32_t(then[axis]);
+			largest = std::max(largest, std::abs(delta[axis]));
+		}
+
+		for (uint8_t size = DELTA_5; size < ABSOLUTE; size++) {
+			if (largest < 1 << (deltaBits(DeltaSize(size)) - 1)) {
+				return DeltaSize(size);
+			}
+		}
+		return ABSOLUTE;
+	}
+
+	static void putU32(std::vector<uint8_t>& out, uint32_t value) {
+		for (int i = 0; i < 4; i++) {
+			out.push_back(value >> (8 * i));
+		}
+	}
+};
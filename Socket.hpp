@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <thread>
 #include <vector>
 #include <initializer_list>
@@ -17,9 +19,20 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 
 #include "queue/readerwriterqueue.h"
+#include "Pool.hpp"
+#include "RecvBuffer.hpp"
+#include "Framing.hpp"
+#include "Metrics.hpp"
+#include "Reactor.hpp"
+#include "Uring.hpp"
+#include "Input.hpp"
+#include "Latency.hpp"
+#include "Protocol.hpp"
 
 using moodycamel::ReaderWriterQueue;
 using moodycamel::BlockingReaderWriterQueue;
@@ -28,40 +41,50 @@ using moodycamel::BlockingReaderWriterQueue;
 
 /* TODO:
  * - client tries to reconnect on disconnect?
- * - allow for way to stack messages and write all at once
- * - StagingState / GameState delta 
+ * - StagingState delta
  */
 
-
-enum MessageType {
-	STAGING_PLAYER_CONNECT,
-	STAGING_PLAYER_DISCONNECT,
-	STAGING_VOTE_TO_START,
-	STAGING_VETO_START,
-	STAGING_START_GAME,
-	STAGING_ROLE_CHANGE,
-	STAGING_ROLE_CHANGE_REJECTION,
-	STAGING_PLAYER_SYNC,
-	INPUT,
-};
-
+// A frame, recycled through Pool<Packet> and shared by reference count.
+// Once packed it is treated as immutable, so one Packet can sit in many write queues:
+// enqueue retain() per queue, and each holder calls release() instead of delete.
 struct Packet {
-	uint8_t header;
+	uint32_t header; // payload length, how it goes on the wire depends on the connection's Framing
 	std::vector<uint8_t> payload;
+	MessageLatency::Stamp stamp; // when it came in, or what it answers (see MessageLatency)
 
-	static Packet* pack(MessageType type, std::initializer_list<uint8_t> extra = {}) {
-		Packet* packet = new Packet();
+	// don't keep huge payload buffers alive in the pool
+	enum : size_t { MAX_POOLED_CAPACITY = 4096 };
 
-		packet->payload.emplace_back(type);
-		packet->payload.insert(packet->payload.end(), extra.begin(), extra.end());
+	// empty packet holding one reference, answering whatever this thread is handling
+	static Packet* acquire() {
+		Packet* packet = Pool<Packet>::get();
+		packet->refs.store(1, std::memory_order_relaxed);
+		packet->stamp = MessageLatency::current();
+		return packet;
+	}
 
-		packet->header = packet->payload.size();
+	Packet* retain() {
+		refs.fetch_add(1, std::memory_order_relaxed);
+		return this;
+	}
 
-		return packet;
+	// last release sends the packet back to the pool
+	void release() {
+		if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+			return;
+		}
+
+		header = 0;
+		payload.clear();
+		stamp = MessageLatency::Stamp();
+		if (payload.capacity() > MAX_POOLED_CAPACITY) {
+			std::vector<uint8_t>().swap(payload);
+		}
+		Pool<Packet>::put(this);
 	}
 
-	static Packet* pack(MessageType type, std::vector<uint8_t> extra) {
-		Packet* packet = new Packet();
+	static Packet* pack(MessageType type, std::initializer_list<uint8_t> extra = {}) {
+		Packet* packet = acquire();
 
 		packet->payload.emplace_back(type);
 		packet->payload.insert(packet->payload.end(), extra.begin(), extra.end());
@@ -70,9 +93,9 @@ struct Packet {
 
 		return packet;
 	}
-/*
-	static Packet* pack(MessageType type, std::initializer_list<uint8_t> extra = {}) {
-		Packet* packet = new Packet();
+
+	static Packet* pack(MessageType type, const std::vector<uint8_t>& extra) {
+		Packet* packet = acquire();
 
 		packet->payload.emplace_back(type);
 		packet->payload.insert(packet->payload.end(), extra.begin(), extra.end());
@@ -80,7 +103,10 @@ struct Packet {
 		packet->header = packet->payload.size();
 
 		return packet;
-	}*/
+	}
+
+private:
+	std::atomic<uint32_t> refs{0};
 };
 
 struct SimpleMessage {
@@ -101,48 +127,171 @@ struct RoleChangeMessage {
 };
 */
 
-class Socket {
+class Socket : public ReactorHandler, public UringHandler {
 
 	int fd;
 	std::atomic<bool> connected;
+	std::atomic<bool> flushPending;
 
 public:
+	// Told when there is something for the socket's owner: a packet in readQueue or a disconnect.
+	// Called from transport threads, so it should just flag the owner to come and look.
+	class Listener {
+	public:
+		virtual ~Listener() {}
+		virtual void onSocketActivity() = 0;
+	};
+	// How sockets move bytes, chosen once at startup before any Socket exists
+	enum class Backend {
+		THREADS, // blocking recv/send on a read and a write thread per socket
+		EPOLL,
+		IO_URING,
+		DETACHED, // no connection, see Socket()
+	};
+
+	static Backend backend() {
+		return selectedBackend();
+	}
+
+	// returns the backend actually in use, io_uring falls back to epoll when the kernel won't have it
+	static Backend useBackend(Backend requested) {
+		if (requested == Backend::IO_URING && !Uring::instance().available()) {
+			std::cout << "io_uring unavailable, falling back to epoll" << std::endl;
+			requested = Backend::EPOLL;
+		}
+
+		selectedBackend() = requested;
+		return requested;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Queue the game loop writes into. Enqueueing wakes the transport to flush it.
+	// Frames are stamped on the way in so the transport can tell how long they waited.
+	class WriteQueue {
+		struct Queued {
+			Packet* packet;
+			Clock::time_point at;
+		};
+
+		Socket& socket;
+		BlockingReaderWriterQueue<Queued> queue;
+
+	public:
+		explicit WriteQueue(Socket& socket) : socket(socket) {}
+
+		bool enqueue(Packet* packet) {
+			if (!socket.connected) {
+				packet->release();
+				return false;
+			}
+
+			queue.enqueue(Queued{packet, Clock::now()});
+			size_t depth = queue.size_approx();
+			socket.writeQueueHigh.raise(depth);
+			TrafficTotals::writeQueueDepth(depth);
+			socket.scheduleFlush();
+			return true;
+		}
+
+		bool try_dequeue(Packet*& packet, Clock::time_point& at) {
+			Queued queued;
+			if (!queue.try_dequeue(queued)) {
+				return false;
+			}
+			packet = queued.packet;
+			at = queued.at;
+			return true;
+		}
+
+		bool try_dequeue(Packet*& packet) {
+			Clock::time_point at;
+			return try_dequeue(packet, at);
+		}
+
+		void wait_dequeue(Packet*& packet, Clock::time_point& at) {
+			Queued queued;
+			queue.wait_dequeue(queued);
+			packet = queued.packet;
+			at = queued.at;
+		}
+
+		size_t size_approx() const {
+			return queue.size_approx();
+		}
+
+		// unblocks wait_dequeue without going through the connected check
+		void wake() {
+			queue.enqueue(Queued{nullptr, Clock::time_point()});
+		}
+	};
+
 	Socket(int fd)
 		: fd(fd),
 			connected(true),
-			readThread([&]() {
-				while (true) {
-					if (!connected) {
-						return;
-					}
+			flushPending(false),
+			writeQueue(*this),
+			mode(backend()),
+			listener(nullptr)
+	{
+		TrafficTotals::add(TrafficTotals::CONNECTIONS, 1);
 
-					Packet* packet = getPacket();
-					if (!packet) {
-						return;
-					}
-					readQueue.enqueue(packet);
+		switch (mode) {
+			case Backend::THREADS: {
+				setBlocking(true);
+				startThreads();
+				break;
+			}
+
+			case Backend::EPOLL: {
+				setBlocking(false);
+				if (!Reactor::instance().add(fd, this)) {
+					connected = false;
 				}
-			}),
-			writeThread([&]() {
-				while (true) {
-					Packet* packet;
-					writeQueue.wait_dequeue(packet);
+				break;
+			}
 
-					if (!packet) {
-						continue;
-					}
+			case Backend::IO_URING: {
+				Uring::instance().add(fd, this);
+				break;
+			}
 
-					if (!connected) {
-						delete packet;
-						return;
-					}
+			case Backend::DETACHED: {
+				break; // there's no fd to give it
+			}
+		}
+	}
 
-					sendPacket(packet);
-				}
-			})
-	{
-		readThread.detach();
-		writeThread.detach();
+	// not connected to anything: frames put in readQueue are taken as if they came in and
+	// whatever is written stays in writeQueue for the owner, for replaying a capture
+	Socket()
+		: fd(-1),
+			connected(true),
+			flushPending(false),
+			writeQueue(*this),
+			mode(Backend::DETACHED),
+			listener(nullptr)
+	{}
+
+	~Socket() {
+		close();
+
+		for (Outgoing& frame : sending) {
+			frame.packet->release();
+		}
+		if (partial) {
+			partial->release();
+		}
+
+		Packet* packet;
+		while (readQueue.try_dequeue(packet)) {
+			packet->release();
+		}
+		while (writeQueue.try_dequeue(packet)) {
+			if (packet) {
+				packet->release();
+			}
+		}
 	}
 
 	// no move or copying
@@ -151,15 +300,48 @@ public:
 	Socket(Socket&& other) = delete;
 	Socket& operator=(Socket&&) = delete;
 
+	// safe to call more than once, the destructor calls it too
 	void close() {
-		::close(fd);
+		stopTransport();
+		if (fd != -1) {
+			::close(fd);
+			fd = -1;
+		}
 	}
 
 	bool isConnected() {
 		return connected;
 	}
 
-	static int initServer(const std::string& port, int backlog = 10) {
+	// nullptr to stop listening, the previous listener may still get one last call
+	void setListener(Listener* l) {
+		listener = l;
+	}
+
+	// what went through this connection so far, readable from any thread
+	TrafficStats stats() const {
+		TrafficStats stats;
+		stats.bytesIn = bytesIn.get();
+		stats.framesIn = framesIn.get();
+		stats.recvCalls = recvCalls.get();
+		stats.bytesOut = bytesOut.get();
+		stats.framesOut = framesOut.get();
+		stats.sendCalls = sendCalls.get();
+		stats.partialSends = partialSends.get();
+		stats.largestBatch = largestBatch.get();
+		stats.framesDropped = framesDropped.get();
+		stats.readQueueDepth = readQueue.size_approx();
+		stats.readQueueHigh = readQueueHigh.get();
+		stats.writeQueueDepth = writeQueue.size_approx();
+		stats.writeQueueHigh = writeQueueHigh.get();
+		stats.writeWaitNs = writeWaitNs.get();
+		stats.writeWaitMaxNs = writeWaitMaxNs.get();
+		stats.connections = 1;
+		return stats;
+	}
+
+	// reusePort lets several listeners bind the same port and share its connections
+	static int initServer(const std::string& port, int backlog = 10, bool reusePort = false) {
 		// Much of the server code here is from
 		// http://beej.us/guide/bgnet/output/html/multipage/clientserver.html#simpleserver
 
@@ -190,6 +372,11 @@ public:
 				exit(1);
 			}
 
+			if (reusePort && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+				perror("setsockopt");
+				exit(1);
+			}
+
 			if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
 				::close(sockfd);
 				perror("server: bind");
@@ -211,134 +398,622 @@ public:
 			exit(1);
 		}
 
-		printf("server: waiting for connections...\n");
-
 		return sockfd;
 	}
 
-	// accept client
-	static int accept(int sockfd) {
-		static auto get_in_addr = [](struct sockaddr* sa) -> void* {
-			if (sa->sa_family == AF_INET) {
-				return &(((struct sockaddr_in*)sa)->sin_addr);
+	ReaderWriterQueue<Packet*> readQueue;
+	WriteQueue writeQueue;
+
+	// epoll callbacks, only ever run on the reactor thread
+
+	bool onEvents(uint32_t events) override {
+		if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			// after a hangup there won't be another edge, so read all the way to EOF
+			bool hangup = events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+			if (!readPackets(hangup)) {
+				return disconnect();
 			}
-			return &(((struct sockaddr_in6*)sa)->sin6_addr);
-		};
+		}
 
-		static auto get_in_port = [](struct sockaddr* sa) -> int {
-			if (sa->sa_family == AF_INET) {
-				return ntohs(((struct sockaddr_in*)sa)->sin_port);
+		if (events & EPOLLOUT) {
+			if (!flush()) {
+				return disconnect();
 			}
-			return ntohs(((struct sockaddr_in6*)sa)->sin6_port);
-		};
+		}
 
-		static struct sockaddr_storage their_addr;	// connector's address information
-		static socklen_t sin_size = sizeof their_addr;
+		return true;
+	}
 
-		int fd = ::accept(sockfd, (struct sockaddr*)&their_addr, &sin_size);
-		if (fd == -1) {
-			perror("accept");
-			return -1;
+	bool onWake() override {
+		// clear first so an enqueue racing with the flush schedules another one
+		flushPending = false;
+
+		if (!flush()) {
+			return disconnect();
 		}
+		return true;
+	}
+
+	// io_uring callbacks, only ever run on the ring thread
 
-		static char s[INET6_ADDRSTRLEN];
-		// convert IP to string to print
-		inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr*)&their_addr), s, sizeof s);
-		printf("server: got connection from %s %d\n", s, get_in_port((struct sockaddr*)&their_addr));
+	bool onData(const uint8_t* data, size_t size) override {
+		countRecv(size);
 
-		return fd;
+		// a provided buffer can hold more than the ring has room for, parse as we go
+		while (size > 0) {
+			size_t n = recvBuffer.append(data, size);
+			data += n;
+			size -= n;
+
+			if (!parseFrames()) {
+				return false;
+			}
+		}
+		recvBuffer.trim();
+		return true;
 	}
 
-	ReaderWriterQueue<Packet*> readQueue;
-	BlockingReaderWriterQueue<Packet*> writeQueue;
+	size_t takeOutgoing(uint8_t* buffer, size_t capacity) override {
+		flushPending = false;
+		drainWriteQueue();
+
+		size_t used = 0;
+		size_t offset = sendingSoFar;
+		for (const Outgoing& frame : sending) {
+			if (used == capacity) {
+				break;
+			}
+			used += copyFrame(frame, offset, buffer + used, capacity - used);
+			offset = 0;
+		}
+
+		if (used > 0) {
+			countSend(used, used < pendingBytes());
+		}
+		retire(used);
+		return used;
+	}
+
+	void onClosed() override {
+		disconnect();
+	}
 
 private:
+	Backend mode;
+	bool stopped = false; // transport torn down, only touched by the owning thread
+	std::atomic<Listener*> listener;
+
 	std::thread readThread;
 	std::thread writeThread;
 
-	// recv that does error checking and connection checking
-	int recv(void* buffer, size_t size) {
-		int n = ::recv(fd, buffer, size, 0);
+	// bytes off the wire that haven't made it into a complete frame yet
+	RecvBuffer recvBuffer;
+
+	// a frame too big for recvBuffer gets assembled here instead
+	Packet* partial = nullptr;
+	size_t partialSoFar = 0;
+
+	// newest INPUT of the frames being parsed, held back in case the next one makes it redundant
+	Packet* heldInput = nullptr;
+
+	// reader thread owns readFraming, writer owns writeFraming
+	Framing readFraming = Framing::LEGACY;
+	Framing writeFraming = Framing::LEGACY;
+
+	// most frames handed to one sendmsg, two iovecs each
+	enum { MAX_BATCH = 256 };
+
+	// a frame pulled off writeQueue with its header already encoded
+	struct Outgoing {
+		Packet* packet;
+		Clock::time_point queuedAt;
+		uint8_t head[FrameHeader::MAX_SIZE];
+		uint8_t headSize;
+	};
+
+	// sending[0] may be partly written (or copied out, for io_uring)
+	std::vector<Outgoing> sending;
+	size_t sendingSoFar = 0;
+
+	Clock::time_point lastRecv; // stamped on every frame the last recv completed, reader only
+
+	// written by whichever thread does that side of the I/O (writeQueueHigh by the enqueuer)
+	Counter bytesIn;
+	Counter framesIn;
+	Counter recvCalls;
+	Counter readQueueHigh;
+	Counter bytesOut;
+	Counter framesOut;
+	Counter sendCalls;
+	Counter partialSends;
+	Counter largestBatch;
+	Counter framesDropped;
+	Counter writeQueueHigh;
+	Counter writeWaitNs;
+	Counter writeWaitMaxNs;
+
+	static Backend& selectedBackend() {
+		static Backend selected = Backend::EPOLL;
+		return selected;
+	}
 
-		if (n < 0) {
-			perror("recv");
+	void setBlocking(bool blocking) {
+		int flags = fcntl(fd, F_GETFL, 0);
+		flags = blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+		if (flags == -1 || fcntl(fd, F_SETFL, flags) == -1) {
+			perror("fcntl");
 		}
+	}
 
-		if (n == 0) {
-			connected = false;
+	void startThreads() {
+		readThread = std::thread([this]() {
+			while (true) {
+				if (!connected) {
+					return;
+				}
+
+				size_t wanted;
+				ssize_t n = recvBuffer.readFrom(fd, wanted);
+				countRecv(n);
+				if (n < 0 && errno == EINTR) {
+					continue;
+				}
+				if (n <= 0) {
+					if (n < 0) {
+						perror("recv");
+					}
+					disconnect();
+					return;
+				}
+
+				if (!parseFrames()) {
+					disconnect();
+					return;
+				}
+			}
+		});
+
+		writeThread = std::thread([this]() {
+			while (true) {
+				Packet* packet;
+				Clock::time_point queuedAt;
+				writeQueue.wait_dequeue(packet, queuedAt);
+
+				if (!connected) {
+					if (packet) {
+						packet->release();
+					}
+					return;
+				}
+
+				if (!packet) {
+					continue;
+				}
+
+				// take whatever else is queued and write it all at once
+				queueFrame(packet, queuedAt);
+				drainWriteQueue();
+
+				while (!sending.empty()) {
+					ssize_t n = sendBatch();
+					if (n < 0 && errno == EINTR) {
+						continue;
+					}
+					if (n <= 0) {
+						disconnect();
+						break;
+					}
+					retire(n);
+				}
+			}
+		});
+	}
+
+	// after this returns no transport thread touches the socket again
+	void stopTransport() {
+		if (stopped) {
+			return; // the fd may already belong to someone else
 		}
+		stopped = true;
+		listener = nullptr;
+
+		switch (mode) {
+			case Backend::THREADS: {
+				connected = false;
+				if (readThread.joinable()) {
+					::shutdown(fd, SHUT_RDWR); // unblocks recv
+					writeQueue.wake();
+					readThread.join();
+					writeThread.join();
+				}
+				break;
+			}
 
-		return n;
+			case Backend::EPOLL: {
+				Reactor::instance().remove(fd);
+				connected = false;
+				break;
+			}
+
+			case Backend::IO_URING: {
+				Uring::instance().remove(fd);
+				connected = false;
+				break;
+			}
+
+			case Backend::DETACHED: {
+				connected = false;
+				break;
+			}
+		}
 	}
 
-	// send that does error checking and connection checking
-	int send(void* buffer, size_t size) {
-		int n = ::send(fd, buffer, size, 0);
+	void scheduleFlush() {
+		switch (mode) {
+			case Backend::THREADS: {
+				break; // writeThread is already blocked on the queue
+			}
 
-		if (n < 0) {
-			perror("send");
+			case Backend::EPOLL: {
+				if (!flushPending.exchange(true)) {
+					Reactor::instance().schedule(fd);
+				}
+				break;
+			}
+
+			case Backend::IO_URING: {
+				if (!flushPending.exchange(true)) {
+					Uring::instance().schedule(fd);
+				}
+				break;
+			}
+
+			case Backend::DETACHED: {
+				break; // the owner takes what's written
+			}
 		}
+	}
 
-		if (n == 0) {
-			connected = false;
+	bool disconnect() {
+		connected = false;
+		notify();
+		return false;
+	}
+
+	void notify() {
+		Listener* l = listener.load();
+		if (l) {
+			l->onSocketActivity();
 		}
+	}
 
-		return n;
+	static bool wouldBlock() {
+		return errno == EAGAIN || errno == EWOULDBLOCK;
 	}
 
-	// get complete packet
-	Packet* getPacket() {
-		unsigned so_far;
-		Packet* packet = new Packet();
+	static bool isFramingUpgrade(const Packet* packet) {
+		return packet->payload.size() == 1 && packet->payload[0] == MessageType::FRAMING_VARINT;
+	}
 
-		// get header (could be multiple bytes in future)
-		so_far = 0;
-		do {
-			int n = recv(&packet->header + so_far, (sizeof packet->header) - so_far);
-			so_far += n;
+	// hand a complete frame to the game loop
+	void received(Packet* packet) {
+		packet->stamp.received = lastRecv;
+		framesIn.add(1);
+		TrafficTotals::add(TrafficTotals::FRAMES_IN, 1);
 
-			if (n == 0) {
-				delete packet;
-				return nullptr;
+		// everything after the request uses varint headers
+		if (isFramingUpgrade(packet)) {
+			readFraming = Framing::VARINT;
+		}
+
+		// a backlog of INPUT frames mostly repeats itself, pass on only the ones that add something
+		if (packet->payload[0] == MessageType::INPUT) {
+			if (heldInput && InputFrame::covers(packet->payload, heldInput->payload)) {
+				heldInput->release();
+			} else {
+				releaseHeldInput();
+			}
+			heldInput = packet;
+			return;
+		}
+
+		releaseHeldInput(); // keep it in order with whatever follows
+		enqueueRead(packet);
+	}
+
+	void releaseHeldInput() {
+		if (heldInput) {
+			enqueueRead(heldInput);
+			heldInput = nullptr;
+		}
+	}
+
+	void enqueueRead(Packet* packet) {
+		readQueue.enqueue(packet);
+		size_t depth = readQueue.size_approx();
+		readQueueHigh.raise(depth);
+		TrafficTotals::readQueueDepth(depth);
+		notify();
+	}
+
+	// a recv syscall (or completion) that returned n
+	void countRecv(ssize_t n) {
+		lastRecv = Clock::now();
+		recvCalls.add(1);
+		TrafficTotals::add(TrafficTotals::RECV_CALLS, 1);
+		if (n > 0) {
+			bytesIn.add(n);
+			TrafficTotals::add(TrafficTotals::BYTES_IN, n);
+		}
+	}
+
+	// a send that got n bytes out, short if the kernel wouldn't take all of them
+	void countSend(ssize_t n, bool shortSend) {
+		sendCalls.add(1);
+		TrafficTotals::add(TrafficTotals::SEND_CALLS, 1);
+		if (n > 0) {
+			bytesOut.add(n);
+			TrafficTotals::add(TrafficTotals::BYTES_OUT, n);
+		}
+		if (shortSend) {
+			partialSends.add(1);
+			TrafficTotals::add(TrafficTotals::PARTIAL_SENDS, 1);
+		}
+	}
+
+	// split every complete frame out of recvBuffer into readQueue, a partial frame stays for next time
+	// returns false on a malformed frame
+	bool parseFrames() {
+		bool ok = splitFrames();
+		releaseHeldInput();
+		return ok;
+	}
+
+	bool splitFrames() {
+		while (!recvBuffer.empty()) {
+			if (partial) {
+				size_t n = std::min(recvBuffer.size(), partial->payload.size() - partialSoFar);
+				recvBuffer.copyOut(0, partial->payload.data() + partialSoFar, n);
+				recvBuffer.consume(n);
+				partialSoFar += n;
+
+				if (partialSoFar == partial->payload.size()) {
+					received(partial);
+					partial = nullptr;
+				}
+				continue;
+			}
+
+			uint32_t length;
+			int headSize = FrameHeader::decode(readFraming, recvBuffer, length);
+			if (headSize < 0) {
+				std::cout << "Bad packet header from client" << std::endl;
+				return false;
+			}
+			if (headSize == 0) {
+				return true;
+			}
+
+			size_t needed = headSize + length;
+			if (recvBuffer.size() < needed && needed <= RecvBuffer::DEFAULT_CAPACITY) {
+				return true; // the rest will fit once it arrives
 			}
-		} while (so_far < sizeof packet->header);
 
-		assert(packet->header > 0);
+			Packet* packet = Packet::acquire();
+			packet->header = length;
+			packet->payload.resize(length);
+			recvBuffer.consume(headSize);
 
-		// get payload
-		packet->payload.resize(packet->header);
-		so_far = 0;
-		do {
-			int n = recv(packet->payload.data() + so_far, packet->header - so_far);
-			so_far += n;
+			if (recvBuffer.size() < length) {
+				// bigger than the ring, copy it out as it arrives
+				partial = packet;
+				partialSoFar = 0;
+				continue;
+			}
+
+			recvBuffer.copyOut(0, packet->payload.data(), length);
+			recvBuffer.consume(length);
+			received(packet);
+		}
+
+		return true;
+	}
+
+	// read until the socket runs dry, queueing every complete packet
+	// returns false when the connection is gone
+	bool readPackets(bool toEnd) {
+		while (true) {
+			size_t wanted;
+			ssize_t n = recvBuffer.readFrom(fd, wanted);
+			countRecv(n);
 
 			if (n == 0) {
-				delete packet;
-				return nullptr;
+				return false;
+			}
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (wouldBlock()) {
+					recvBuffer.trim();
+					return true;
+				}
+				perror("recv");
+				return false;
 			}
-		} while (so_far < packet->header);
-		packet->payload.resize(packet->header);
 
-		return packet;
+			if (!parseFrames()) {
+				return false;
+			}
+
+			// a short read means the kernel buffer is empty, skip the recv that would just say EAGAIN
+			if (!toEnd && (size_t)n < wanted) {
+				recvBuffer.trim();
+				return true;
+			}
+		}
+	}
+
+	// total bytes a frame puts on the wire
+	static size_t frameSize(const Outgoing& frame) {
+		return frame.headSize + frame.packet->payload.size();
+	}
+
+	// copy frame bytes starting at offset, returns how many were copied
+	static size_t copyFrame(const Outgoing& frame, size_t offset, uint8_t* buffer, size_t capacity) {
+		size_t used = 0;
+
+		if (offset < frame.headSize) {
+			used = std::min(capacity, (size_t)frame.headSize - offset);
+			memcpy(buffer, frame.head + offset, used);
+			offset += used;
+		}
+
+		size_t payloadSoFar = offset - frame.headSize;
+		size_t n = std::min(capacity - used, frame.packet->payload.size() - payloadSoFar);
+		memcpy(buffer + used, frame.packet->payload.data() + payloadSoFar, n);
+
+		return used + n;
+	}
+
+	// bytes in sending not written yet
+	size_t pendingBytes() const {
+		size_t total = 0;
+		for (const Outgoing& frame : sending) {
+			total += frameSize(frame);
+		}
+		return total - sendingSoFar;
+	}
+
+	// encode the header and put the frame at the end of sending
+	void queueFrame(Packet* packet, Clock::time_point queuedAt) {
+		Outgoing frame;
+		frame.packet = packet;
+		frame.queuedAt = queuedAt;
+		frame.headSize = FrameHeader::encode(writeFraming, packet->payload.size(), frame.head);
+
+		if (frame.headSize == 0) {
+			// counted rather than logged, a sender that keeps doing it would flood the console
+			framesDropped.add(1);
+			TrafficTotals::add(TrafficTotals::FRAMES_DROPPED, 1);
+			packet->release();
+			return;
+		}
+
+		// the echo still goes out in the old framing, everything after it uses varints
+		if (isFramingUpgrade(packet)) {
+			writeFraming = Framing::VARINT;
+		}
+
+		sending.push_back(frame);
 	}
 
-	// sends all data in vector
-	bool sendPacket(Packet* packet) {
-		// send header (could be multiple bytes in future)
-		int n = send(&packet->header, 1);
-		if (n <= 0) {
-			return false;
+	// move everything currently in writeQueue onto the end of sending
+	void drainWriteQueue() {
+		Packet* packet;
+		Clock::time_point queuedAt;
+		while (sending.size() < MAX_BATCH && writeQueue.try_dequeue(packet, queuedAt)) {
+			if (packet) {
+				queueFrame(packet, queuedAt);
+			}
+		}
+	}
+
+	// one sendmsg covering the unwritten part of every frame in sending
+	ssize_t sendBatch() {
+		struct iovec iov[2 * MAX_BATCH];
+		size_t count = 0;
+		size_t total = 0;
+
+		size_t offset = sendingSoFar;
+		for (Outgoing& frame : sending) {
+			if (offset < frame.headSize) {
+				iov[count].iov_base = frame.head + offset;
+				iov[count].iov_len = frame.headSize - offset;
+				total += iov[count].iov_len;
+				count++;
+				offset = frame.headSize;
+			}
+
+			size_t payloadSoFar = offset - frame.headSize;
+			iov[count].iov_base = frame.packet->payload.data() + payloadSoFar;
+			iov[count].iov_len = frame.packet->payload.size() - payloadSoFar;
+			total += iov[count].iov_len;
+			count++;
+			offset = 0;
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+		countSend(n, n < (ssize_t)total && (n >= 0 || wouldBlock()));
+
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			perror("sendmsg");
+		}
+
+		return n;
+	}
+
+	// n bytes of sending made it out, free every frame that is now complete
+	void retire(size_t n) {
+		if (n == 0) {
+			return;
 		}
 
-		unsigned so_far = 0;
-		do {
-			int m = send(packet->payload.data() + so_far, packet->payload.size() - so_far);
-			so_far += m;
-			if (m <= 0) {
+		n += sendingSoFar;
+
+		Clock::time_point now = Clock::now();
+		size_t done = 0;
+		while (done < sending.size() && n >= frameSize(sending[done])) {
+			n -= frameSize(sending[done]);
+			countWait(now - sending[done].queuedAt);
+			MessageLatency::wired(sending[done].packet->stamp, now);
+			sending[done].packet->release();
+			done++;
+		}
+
+		sending.erase(sending.begin(), sending.begin() + done);
+		sendingSoFar = n;
+
+		framesOut.add(done);
+		TrafficTotals::add(TrafficTotals::FRAMES_OUT, done);
+		largestBatch.raise(done);
+		TrafficTotals::largestBatch(done);
+	}
+
+	// how long a frame that just made it out sat between enqueue and the wire
+	void countWait(Clock::duration wait) {
+		uint64_t ns = Histogram::nanoseconds(wait);
+		writeWaitNs.add(ns);
+		writeWaitMaxNs.raise(ns);
+		TrafficTotals::wrote(ns);
+	}
+
+	// write queued packets until the queue is empty or the socket is full
+	// returns false when the connection is gone
+	bool flush() {
+		while (true) {
+			drainWriteQueue();
+			if (sending.empty()) {
+				return true;
+			}
+
+			ssize_t n = sendBatch();
+			if (n == 0) {
 				return false;
 			}
-		} while (so_far < packet->payload.size());
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return wouldBlock(); // EPOLLOUT will bring us back
+			}
 
-		return true;
+			retire(n);
+		}
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/type_aligned.hpp"
+
+// Uniform grid over the ground plane (x, z) for proximity queries, hashed into a bucket
+// table so the world needs no bounds. Rebuilt from the entity positions every step with a
+// counting sort: O(n), no allocation once warmed up. Queries hand out dense indices into
+// the positions it was built from, and measure real 3D distance.
+class SpatialGrid {
+public:
+	explicit SpatialGrid(float cellSize) : cellSize(cellSize), inverseCell(1.0f / cellSize) {}
+
+	float getCellSize() const {
+		return cellSize;
+	}
+
+	void build(const std::vector<glm::aligned_vec4>& from) {
+		positions = &from;
+		size_t n = from.size();
+
+		size_t buckets = 64;
+		while (buckets < 2 * n) {
+			buckets <<= 1;
+		}
+		mask = buckets - 1;
+
+		bucketOf.resize(n);
+		start.assign(buckets + 1, 0);
+		for (size_t i = 0; i < n; i++) {
+			bucketOf[i] = bucket(cellOf(from[i].x), cellOf(from[i].z));
+			start[bucketOf[i] + 1]++;
+		}
+		for (size_t b = 0; b < buckets; b++) {
+			start[b + 1] += start[b];
+		}
+
+		sorted.resize(n);
+		fill.assign(start.begin(), start.end() - 1);
+		for (size_t i = 0; i < n; i++) {
+			sorted[fill[bucketOf[i]]++] = i;
+		}
+	}
+
+	// fn(index, distance squared) for everything within radius of center
+	template <typename F>
+	void radius(const glm::vec3& center, float r, F fn) const {
+		float r2 = r * r;
+		forBuckets(center, r, [&](uint32_t b) {
+			for (uint32_t k = start[b]; k < start[b + 1]; k++) {
+				uint32_t i = sorted[k];
+				float d2 = distance2(center, i);
+				if (d2 <= r2) {
+					fn(i, d2);
+				}
+			}
+		});
+	}
+
+	void radius(const glm::vec3& center, float r, std::vector<uint32_t>& out) const {
+		radius(center, r, [&](uint32_t i, float) { out.push_back(i); });
+	}
+
+	// up to k closest to center, nearest first, looking no further than maxRadius
+	void nearest(const glm::vec3& center, size_t k, float maxRadius, std::vector<uint32_t>& out) const {
+		std::vector<std::pair<float, uint32_t>> found;
+
+		// widen the search until k are in range, anything inside r is then known to be complete
+		for (float r = std::min(cellSize, maxRadius); k > 0; r = std::min(2.0f * r, maxRadius)) {
+			found.clear();
+			radius(center, r, [&](uint32_t i, float d2) { found.emplace_back(d2, i); });
+
+			if (found.size() >= k || r >= maxRadius) {
+				break;
+			}
+		}
+
+		size_t keep = std::min(k, found.size());
+		std::partial_sort(found.begin(), found.begin() + keep, found.end());
+		for (size_t i = 0; i < keep; i++) {
+			out.push_back(found[i].second);
+		}
+	}
+
+	// fn(a, b) once for every pair (a < b) within r of each other
+	template <typename F>
+	void pairs(float r, F fn) const {
+		float r2 = r * r;
+		for (uint32_t a = 0; a < positions->size(); a++) {
+			glm::vec3 center((*positions)[a]);
+			forBuckets(center, r, [&](uint32_t b) {
+				for (uint32_t k = start[b]; k < start[b + 1]; k++) {
+					uint32_t other = sorted[k];
+					if (other > a && distance2(center, other) <= r2) {
+						fn(a, other);
+					}
+				}
+			});
+		}
+	}
+
+	// one pass of radius queries, fn(center, other) for every center and everything near it but itself
+	// capture and proximity checks for a tick go through here together
+	template <typename F>
+	void around(const std::vector<uint32_t>& centers, float r, F fn) const {
+		for (uint32_t c : centers) {
+			radius(glm::vec3((*positions)[c]), r, [&](uint32_t i, float) {
+				if (i != c) {
+					fn(c, i);
+				}
+			});
+		}
+	}
+
+private:
+	float cellSize;
+	float inverseCell;
+	size_t mask = 0;
+
+	const std::vector<glm::aligned_vec4>* positions = nullptr;
+	std::vector<uint32_t> bucketOf; // by index
+	std::vector<uint32_t> start; // bucket -> first entry in sorted, one extra at the end
+	std::vector<uint32_t> fill; // build scratch
+	std::vector<uint32_t> sorted; // indices grouped by bucket
+
+	int32_t cellOf(float v) const {
+		return (int32_t)std::floor(v * inverseCell);
+	}
+
+	uint32_t bucket(int32_t x, int32_t z) const {
+		return ((uint32_t)x * 73856093u ^ (uint32_t)z * 19349663u) & mask;
+	}
+
+	float distance2(const glm::vec3& center, uint32_t i) const {
+		glm::vec3 d = glm::vec3((*positions)[i]) - center;
+		return glm::dot(d, d);
+	}
+
+	// fn(bucket) once for each bucket any cell within r of center hashes to
+	template <typename F>
+	void forBuckets(const glm::vec3& center, float r, F fn) const {
+		if (!positions || positions->empty()) {
+			return;
+		}
+
+		int32_t x0 = cellOf(center.x - r), x1 = cellOf(center.x + r);
+		int32_t z0 = cellOf(center.z - r), z1 = cellOf(center.z + r);
+
+		// a huge radius covers every bucket anyway
+		if ((uint64_t)(x1 - x0 + 1) * (z1 - z0 + 1) > mask + 1) {
+			for (uint32_t b = 0; b <= mask; b++) {
+				fn(b);
+			}
+			return;
+		}
+
+		// different cells can share a bucket, visit each only once
+		uint32_t seen[16];
+		size_t seenCount = 0;
+		std::vector<uint32_t> seenMore;
+
+		for (int32_t x = x0; x <= x1; x++) {
+			for (int32_t z = z0; z <= z1; z++) {
+				uint32_t b = bucket(x, z);
+				if (std::find(seen, seen + seenCount, b) != seen + seenCount
+						|| std::find(seenMore.begin(), seenMore.end(), b) != seenMore.end()) {
+					continue;
+				}
+				if (seenCount < 16) {
+					seen[seenCount++] = b;
+				} else {
+					seenMore.push_back(b);
+				}
+				fn(b);
+			}
+		}
+	}
+};
@@ -0,0 +1,721 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "queue/readerwriterqueue.h"
+#include "Reactor.hpp"
+#include "Socket.hpp"
+
+/* UDP channel for IN_GAME traffic, the TCP Socket stays for staging and control.
+ *
+ * Every datagram starts with
+ *   token:u32 sequence:u16 ack:u16 ackBits:u32
+ * where ack is the newest sequence we've seen from the peer and bit i of ackBits
+ * covers ack - 1 - i. The body is one of
+ *   UNRELIABLE  message bytes, dropped unless newer than the last one delivered
+ *   RELIABLE    count:u8 then count times (id:u16 length:u16 bytes), delivered in id order
+ *   FRAGMENT    group:u16 index:u8 count:u8 bytes, pieces of an unreliable message
+ *   ACK         nothing, just the header
+ * Reliable messages are remembered per datagram sequence, and only the ones whose
+ * datagrams were never acked get sent again. All integers are little endian.
+ *
+ * A client learns its token from a UDP_TOKEN message on TCP and includes it in every
+ * datagram, which is how the server ties the UDP address to the player.
+ */
+
+class UdpServer;
+
+class UdpConnection {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum : size_t {
+		MAX_DATAGRAM = 1200, // safe under any sane path MTU
+		HEADER_SIZE = 12,
+		WINDOW = 256, // datagrams and reliable messages we keep track of
+		MAX_RELIABLE_SIZE = MAX_DATAGRAM - HEADER_SIZE - 2 - 4,
+		FRAGMENT_SIZE = MAX_DATAGRAM - HEADER_SIZE - 5,
+		MAX_FRAGMENTS = 255,
+		MAX_MESSAGES_PER_DATAGRAM = 32,
+	};
+
+	enum BodyType : uint8_t {
+		UNRELIABLE,
+		RELIABLE,
+		FRAGMENT,
+		ACK,
+	};
+
+	// raw bytes handed over by the reactor thread
+	struct Datagram {
+		struct sockaddr_storage from;
+		socklen_t fromLen;
+		Packet* bytes;
+	};
+
+	UdpConnection(UdpServer& server, uint32_t token) : server(server), token(token) {
+		memset(&peer, 0, sizeof peer);
+	}
+
+	~UdpConnection();
+
+	UdpConnection(const UdpConnection&) = delete;
+	UdpConnection& operator=(const UdpConnection&) = delete;
+
+	uint32_t getToken() const {
+		return token;
+	}
+
+	// true once the client has sent us a datagram, so we know where to send
+	bool ready() const {
+		return peerLen > 0;
+	}
+
+	// process everything the reactor received since the last call and
+	// append delivered messages to out (caller releases them)
+	void receive(Clock::time_point now, std::vector<Packet*>& out);
+
+	// latest-wins message, fragmented if it doesn't fit in one datagram
+	// returns false if it's too big or we have no address yet, packet is released either way
+	bool sendUnreliable(Packet* packet, Clock::time_point now);
+
+	// ordered, resent until acked, returns false when the window is full or the message
+	// is too big for a datagram, packet is released either way
+	bool sendReliable(Packet* packet);
+
+	// send reliable messages that are new or overdue, and a bare ack if the peer is owed one
+	void flush(Clock::time_point now);
+
+private:
+	friend class UdpServer;
+
+	struct Sent {
+		bool valid = false;
+		bool acked = false;
+		uint16_t sequence = 0;
+		Clock::time_point at;
+		uint8_t count = 0;
+		uint16_t ids[MAX_MESSAGES_PER_DATAGRAM];
+	};
+
+	struct Outgoing {
+		Packet* packet = nullptr;
+		uint16_t id = 0; // the slot is reused WINDOW ids later, acks check it's still theirs
+		bool sent = false;
+		Clock::time_point lastSent;
+	};
+
+	UdpServer& server;
+	uint32_t token;
+
+	// written by the reactor thread, read by the game thread
+	moodycamel::ReaderWriterQueue<Datagram> inbound;
+
+	// everything below is game thread only
+	struct sockaddr_storage peer;
+	socklen_t peerLen = 0;
+
+	// starts at 1 so the ack of 0 a client sends before hearing from us doesn't match anything
+	uint16_t localSequence = 1;
+	Sent sent[WINDOW];
+	float rtt = 0.1f; // smoothed from acked datagrams, paces resends
+
+	bool anyReceived = false;
+	uint16_t remoteSequence = 0;
+	uint32_t remoteBits = 0;
+	bool ackOwed = false;
+
+	uint16_t nextReliableId = 0;
+	uint16_t oldestUnacked = 0;
+	Outgoing outbox[WINDOW];
+
+	uint16_t nextExpectedId = 0;
+	Packet* inbox[WINDOW] = {};
+
+	Clock::time_point arriving; // when the datagram being taken apart was received
+
+	bool anyUnreliable = false;
+	uint16_t lastUnreliable = 0;
+
+	bool assembling = false;
+	uint16_t fragmentGroup = 0;
+	uint8_t fragmentCount = 0;
+	unsigned fragmentsReceived = 0;
+	size_t fragmentLength = 0;
+	uint8_t fragmentHave[MAX_FRAGMENTS] = {};
+	std::vector<uint8_t> fragmentData;
+
+	static bool newer(uint16_t a, uint16_t b) {
+		return (int16_t)(a - b) > 0;
+	}
+
+	static void put16(uint8_t* out, uint16_t v) {
+		out[0] = v;
+		out[1] = v >> 8;
+	}
+
+	static void put32(uint8_t* out, uint32_t v) {
+		put16(out, v);
+		put16(out + 2, v >> 16);
+	}
+
+	static uint16_t get16(const uint8_t* in) {
+		return in[0] | (in[1] << 8);
+	}
+
+	static uint32_t get32(const uint8_t* in) {
+		return get16(in) | ((uint32_t)get16(in + 2) << 16);
+	}
+
+	// fills in the header, records the datagram and sends it
+	void send(uint8_t* datagram, size_t size, Clock::time_point now, const uint16_t* ids = nullptr, uint8_t count = 0);
+
+	void processAck(uint16_t ack, uint32_t bits, Clock::time_point now);
+	void ackSent(uint16_t sequence, Clock::time_point now);
+	void trackRemote(uint16_t sequence);
+	void deliverUnreliable(uint16_t sequence, const uint8_t* data, size_t size, std::vector<Packet*>& out);
+	void receiveReliable(const uint8_t* body, size_t size, std::vector<Packet*>& out);
+	void receiveFragment(const uint8_t* body, size_t size, std::vector<Packet*>& out);
+
+	// drop INPUT messages from out[first..] that a later one repeats in full
+	static void coalesceInputs(std::vector<Packet*>& out, size_t first);
+
+	static Packet* packetFrom(const uint8_t* data, size_t size) {
+		Packet* packet = Packet::acquire();
+		packet->payload.assign(data, data + size);
+		packet->header = size;
+		return packet;
+	}
+};
+
+// The one UDP socket everyone shares, read on the reactor thread and routed by token
+class UdpServer : public ReactorHandler {
+
+	int fd = -1;
+
+	// held while routing, so a connection that unregistered never gets another datagram
+	std::mutex routesMutex;
+	std::unordered_map<uint32_t, UdpConnection*> routes;
+
+	std::mt19937 random{std::random_device{}()};
+
+	// reactor thread only
+	enum { BATCH = 32 };
+	uint8_t buffers[BATCH][UdpConnection::MAX_DATAGRAM];
+
+public:
+	explicit UdpServer(const std::string& port) {
+		struct addrinfo hints, *servinfo, *p;
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		int rv = getaddrinfo(nullptr, port.c_str(), &hints, &servinfo);
+		if (rv != 0) {
+			fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+			exit(1);
+		}
+
+		for (p = servinfo; p != NULL; p = p->ai_next) {
+			fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
+			if (fd == -1) {
+				perror("udp: socket");
+				continue;
+			}
+
+			if (bind(fd, p->ai_addr, p->ai_addrlen) == -1) {
+				::close(fd);
+				perror("udp: bind");
+				continue;
+			}
+
+			break;
+		}
+
+		freeaddrinfo(servinfo);
+
+		if (p == NULL) {
+			fprintf(stderr, "udp: failed to bind\n");
+			exit(1);
+		}
+
+		Reactor::instance().add(fd, this);
+	}
+
+	// no socket, for replaying a capture: connections never hear from a peer so they never
+	// send, and tokens come from a fixed seed so every replay hands out the same ones
+	struct Detached {};
+	explicit UdpServer(Detached) : random(1) {}
+
+	~UdpServer() {
+		if (fd != -1) {
+			Reactor::instance().remove(fd);
+			::close(fd);
+		}
+	}
+
+	UdpServer(const UdpServer&) = delete;
+	UdpServer& operator=(const UdpServer&) = delete;
+
+	int getFd() const {
+		return fd;
+	}
+
+	// a new connection with an unused token, ready to receive as soon as the client sends
+	UdpConnection* connect() {
+		std::lock_guard<std::mutex> lock(routesMutex);
+
+		uint32_t token;
+		do {
+			token = random();
+		} while (token == 0 || routes.count(token));
+
+		UdpConnection* connection = new UdpConnection(*this, token);
+		routes[token] = connection;
+		return connection;
+	}
+
+	void disconnect(UdpConnection* connection) {
+		std::lock_guard<std::mutex> lock(routesMutex);
+		routes.erase(connection->getToken());
+	}
+
+	bool onEvents(uint32_t events) override {
+		if (!(events & EPOLLIN)) {
+			return true;
+		}
+
+		struct mmsghdr messages[BATCH];
+		struct iovec iovecs[BATCH];
+		struct sockaddr_storage addresses[BATCH];
+
+		while (true) {
+			for (unsigned i = 0; i < BATCH; i++) {
+				iovecs[i].iov_base = buffers[i];
+				iovecs[i].iov_len = sizeof buffers[i];
+				memset(&messages[i], 0, sizeof messages[i]);
+				messages[i].msg_hdr.msg_iov = &iovecs[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+				messages[i].msg_hdr.msg_name = &addresses[i];
+				messages[i].msg_hdr.msg_namelen = sizeof addresses[i];
+			}
+
+			int n = recvmmsg(fd, messages, BATCH, 0, nullptr);
+			if (n == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					perror("recvmmsg");
+				}
+				return true;
+			}
+
+			UdpConnection::Clock::time_point now = UdpConnection::Clock::now();
+			std::lock_guard<std::mutex> lock(routesMutex);
+			for (int i = 0; i < n; i++) {
+				size_t size = messages[i].msg_len;
+				if (size < UdpConnection::HEADER_SIZE + 1 || (messages[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+					continue;
+				}
+
+				auto route = routes.find(UdpConnection::get32(buffers[i]));
+				if (route == routes.end()) {
+					continue;
+				}
+
+				UdpConnection::Datagram datagram;
+				datagram.from = addresses[i];
+				datagram.fromLen = messages[i].msg_hdr.msg_namelen;
+				datagram.bytes = UdpConnection::packetFrom(buffers[i], size);
+				datagram.bytes->stamp.received = now;
+				route->second->inbound.enqueue(datagram);
+			}
+
+			if ((unsigned)n < BATCH) {
+				return true;
+			}
+		}
+	}
+
+	bool onWake() override {
+		return true;
+	}
+};
+
+inline UdpConnection::~UdpConnection() {
+	server.disconnect(this);
+
+	Datagram datagram;
+	while (inbound.try_dequeue(datagram)) {
+		datagram.bytes->release();
+	}
+	for (Outgoing& outgoing : outbox) {
+		if (outgoing.packet) {
+			outgoing.packet->release();
+		}
+	}
+	for (Packet* packet : inbox) {
+		if (packet) {
+			packet->release();
+		}
+	}
+}
+
+inline void UdpConnection::receive(Clock::time_point now, std::vector<Packet*>& out) {
+	size_t first = out.size();
+
+	Datagram datagram;
+	while (inbound.try_dequeue(datagram)) {
+		const uint8_t* data = datagram.bytes->payload.data();
+		size_t size = datagram.bytes->payload.size();
+		arriving = datagram.bytes->stamp.received;
+
+		// the client's address can change (NAT rebinding), but only its newest datagram
+		// moves it, so a replayed or stale one with the token can't take the route over
+		uint16_t sequence = get16(data + 4);
+		bool newest = !anyReceived || newer(sequence, remoteSequence);
+		bool samePeer = datagram.fromLen == peerLen && memcmp(&datagram.from, &peer, peerLen) == 0;
+		if (!newest && !samePeer) {
+			datagram.bytes->release();
+			continue;
+		}
+		if (!samePeer) {
+			memcpy(&peer, &datagram.from, datagram.fromLen);
+			peerLen = datagram.fromLen;
+		}
+
+		processAck(get16(data + 6), get32(data + 8), now);
+		trackRemote(sequence);
+
+		const uint8_t* body = data + HEADER_SIZE + 1;
+		size_t bodySize = size - HEADER_SIZE - 1;
+
+		switch (data[HEADER_SIZE]) {
+			case UNRELIABLE: {
+				deliverUnreliable(sequence, body, bodySize, out);
+				break;
+			}
+			case RELIABLE: {
+				receiveReliable(body, bodySize, out);
+				break;
+			}
+			case FRAGMENT: {
+				receiveFragment(body, bodySize, out);
+				break;
+			}
+			default: {
+				break;
+			}
+		}
+
+		datagram.bytes->release();
+	}
+
+	coalesceInputs(out, first);
+}
+
+inline void UdpConnection::coalesceInputs(std::vector<Packet*>& out, size_t first) {
+	Packet* latest = nullptr;
+	for (size_t i = out.size(); i-- > first;) {
+		Packet* packet = out[i];
+		if (packet->payload.empty() || packet->payload[0] != MessageType::INPUT) {
+			continue;
+		}
+		if (latest && InputFrame::covers(latest->payload, packet->payload)) {
+			packet->release();
+			out[i] = nullptr;
+			continue;
+		}
+		latest = packet;
+	}
+	out.erase(std::remove(out.begin() + first, out.end(), nullptr), out.end());
+}
+
+inline bool UdpConnection::sendUnreliable(Packet* packet, Clock::time_point now) {
+	const std::vector<uint8_t>& message = packet->payload;
+	uint8_t datagram[MAX_DATAGRAM];
+	bool ok = true;
+
+	if (!ready() || message.empty()) {
+		ok = false;
+	} else if (message.size() <= MAX_DATAGRAM - HEADER_SIZE - 1) {
+		datagram[HEADER_SIZE] = UNRELIABLE;
+		memcpy(datagram + HEADER_SIZE + 1, message.data(), message.size());
+		send(datagram, HEADER_SIZE + 1 + message.size(), now);
+	} else {
+		size_t count = (message.size() + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+		if (count > MAX_FRAGMENTS) {
+			ok = false;
+		} else {
+			uint16_t group = localSequence; // sequence of the first fragment
+			for (size_t i = 0; i < count; i++) {
+				size_t offset = i * FRAGMENT_SIZE;
+				size_t n = std::min((size_t)FRAGMENT_SIZE, message.size() - offset);
+
+				uint8_t* body = datagram + HEADER_SIZE;
+				body[0] = FRAGMENT;
+				put16(body + 1, group);
+				body[3] = i;
+				body[4] = count;
+				memcpy(body + 5, message.data() + offset, n);
+				send(datagram, HEADER_SIZE + 5 + n, now);
+			}
+		}
+	}
+
+	packet->release();
+	return ok;
+}
+
+inline bool UdpConnection::sendReliable(Packet* packet) {
+	if (packet->payload.size() > MAX_RELIABLE_SIZE || (uint16_t)(nextReliableId - oldestUnacked) >= WINDOW) {
+		packet->release();
+		return false;
+	}
+
+	Outgoing& slot = outbox[nextReliableId % WINDOW];
+	slot.packet = packet;
+	slot.id = nextReliableId;
+	slot.sent = false;
+	nextReliableId++;
+	return true;
+}
+
+inline void UdpConnection::flush(Clock::time_point now) {
+	if (!ready()) {
+		return;
+	}
+
+	auto resendAfter = std::chrono::duration<float>(std::max(0.05f, 1.5f * rtt));
+
+	uint8_t datagram[MAX_DATAGRAM];
+	uint16_t ids[MAX_MESSAGES_PER_DATAGRAM];
+	uint8_t count = 0;
+	size_t size = HEADER_SIZE + 2;
+
+	for (uint16_t id = oldestUnacked; id != nextReliableId; id++) {
+		Outgoing& outgoing = outbox[id % WINDOW];
+		if (!outgoing.packet || (outgoing.sent && now - outgoing.lastSent < resendAfter)) {
+			continue;
+		}
+
+		size_t length = outgoing.packet->payload.size();
+		if (size + 4 + length > MAX_DATAGRAM || count == MAX_MESSAGES_PER_DATAGRAM) {
+			datagram[HEADER_SIZE] = RELIABLE;
+			datagram[HEADER_SIZE + 1] = count;
+			send(datagram, size, now, ids, count);
+			count = 0;
+			size = HEADER_SIZE + 2;
+		}
+
+		put16(datagram + size, id);
+		put16(datagram + size + 2, length);
+		memcpy(datagram + size + 4, outgoing.packet->payload.data(), length);
+		size += 4 + length;
+		ids[count++] = id;
+
+		outgoing.sent = true;
+		outgoing.lastSent = now;
+	}
+
+	if (count > 0) {
+		datagram[HEADER_SIZE] = RELIABLE;
+		datagram[HEADER_SIZE + 1] = count;
+		send(datagram, size, now, ids, count);
+	}
+
+	if (ackOwed) {
+		datagram[HEADER_SIZE] = ACK;
+		send(datagram, HEADER_SIZE + 1, now);
+	}
+}
+
+inline void UdpConnection::send(uint8_t* datagram, size_t size, Clock::time_point now, const uint16_t* ids, uint8_t count) {
+	uint16_t sequence = localSequence++;
+
+	put32(datagram, token);
+	put16(datagram + 4, sequence);
+	put16(datagram + 6, remoteSequence);
+	put32(datagram + 8, remoteBits);
+
+	Sent& record = sent[sequence % WINDOW];
+	record.valid = true;
+	record.acked = false;
+	record.sequence = sequence;
+	record.at = now;
+	record.count = count;
+	std::copy(ids, ids + count, record.ids);
+
+	// every datagram carries our acks, nothing separate needed this tick
+	ackOwed = false;
+
+	if (sendto(server.getFd(), datagram, size, 0, (struct sockaddr*)&peer, peerLen) == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		perror("sendto");
+	}
+}
+
+inline void UdpConnection::processAck(uint16_t ack, uint32_t bits, Clock::time_point now) {
+	ackSent(ack, now);
+	for (unsigned i = 0; i < 32; i++) {
+		if (bits & (1u << i)) {
+			ackSent(ack - 1 - i, now);
+		}
+	}
+
+	// slide the reliable window past everything acked
+	while (oldestUnacked != nextReliableId && !outbox[oldestUnacked % WINDOW].packet) {
+		oldestUnacked++;
+	}
+}
+
+inline void UdpConnection::ackSent(uint16_t sequence, Clock::time_point now) {
+	Sent& record = sent[sequence % WINDOW];
+	if (!record.valid || record.acked || record.sequence != sequence) {
+		return;
+	}
+	record.acked = true;
+
+	float sample = std::chrono::duration<float>(now - record.at).count();
+	rtt += (sample - rtt) * 0.1f;
+
+	for (uint8_t i = 0; i < record.count; i++) {
+		// a late ack for a message already acked through a resend mustn't free what took its slot
+		Outgoing& outgoing = outbox[record.ids[i] % WINDOW];
+		if (outgoing.packet && outgoing.id == record.ids[i]) {
+			outgoing.packet->release();
+			outgoing.packet = nullptr;
+		}
+	}
+}
+
+inline void UdpConnection::trackRemote(uint16_t sequence) {
+	ackOwed = true;
+
+	if (!anyReceived) {
+		anyReceived = true;
+		remoteSequence = sequence;
+		remoteBits = 0;
+		return;
+	}
+
+	if (newer(sequence, remoteSequence)) {
+		uint16_t shift = sequence - remoteSequence;
+		remoteBits = shift >= 32 ? 0 : (remoteBits << shift);
+		if (shift <= 32) {
+			remoteBits |= 1u << (shift - 1); // the old newest
+		}
+		remoteSequence = sequence;
+	} else {
+		uint16_t behind = remoteSequence - sequence;
+		if (behind >= 1 && behind <= 32) {
+			remoteBits |= 1u << (behind - 1);
+		}
+	}
+}
+
+inline void UdpConnection::deliverUnreliable(uint16_t sequence, const uint8_t* data, size_t size, std::vector<Packet*>& out) {
+	if (size == 0 || (anyUnreliable && !newer(sequence, lastUnreliable))) {
+		return; // an older state than what we already have
+	}
+
+	anyUnreliable = true;
+	lastUnreliable = sequence;
+	out.push_back(packetFrom(data, size));
+	out.back()->stamp.received = arriving;
+}
+
+inline void UdpConnection::receiveReliable(const uint8_t* body, size_t size, std::vector<Packet*>& out) {
+	if (size < 1) {
+		return;
+	}
+
+	unsigned count = body[0];
+	size_t offset = 1;
+
+	for (unsigned i = 0; i < count && offset + 4 <= size; i++) {
+		uint16_t id = get16(body + offset);
+		size_t length = get16(body + offset + 2);
+		offset += 4;
+		if (length == 0 || offset + length > size) {
+			return;
+		}
+
+		// not a duplicate and inside the window
+		uint16_t ahead = id - nextExpectedId;
+		if (ahead < WINDOW && !inbox[id % WINDOW]) {
+			inbox[id % WINDOW] = packetFrom(body + offset, length);
+			inbox[id % WINDOW]->stamp.received = arriving;
+		}
+		offset += length;
+	}
+
+	while (inbox[nextExpectedId % WINDOW]) {
+		out.push_back(inbox[nextExpectedId % WINDOW]);
+		inbox[nextExpectedId % WINDOW] = nullptr;
+		nextExpectedId++;
+	}
+}
+
+inline void UdpConnection::receiveFragment(const uint8_t* body, size_t size, std::vector<Packet*>& out) {
+	if (size < 5) {
+		return;
+	}
+
+	uint16_t group = get16(body);
+	uint8_t index = body[2];
+	uint8_t count = body[3];
+	const uint8_t* data = body + 4;
+	size_t length = size - 4;
+
+	if (count == 0 || index >= count || length > FRAGMENT_SIZE || (index + 1 < count && length != FRAGMENT_SIZE)) {
+		return;
+	}
+
+	// newer group replaces whatever was half assembled, older ones are stale
+	if (!assembling || newer(group, fragmentGroup)) {
+		if (anyUnreliable && !newer(group, lastUnreliable)) {
+			return;
+		}
+		assembling = true;
+		fragmentGroup = group;
+		fragmentCount = count;
+		fragmentsReceived = 0;
+		fragmentLength = 0;
+		memset(fragmentHave, 0, sizeof fragmentHave);
+		fragmentData.resize((size_t)count * FRAGMENT_SIZE);
+	} else if (group != fragmentGroup || count != fragmentCount) {
+		return;
+	}
+
+	if (fragmentHave[index]) {
+		return;
+	}
+	fragmentHave[index] = 1;
+	fragmentsReceived++;
+	memcpy(fragmentData.data() + (size_t)index * FRAGMENT_SIZE, data, length);
+	if (index + 1 == count) {
+		fragmentLength = (size_t)index * FRAGMENT_SIZE + length;
+	}
+
+	if (fragmentsReceived == fragmentCount) {
+		assembling = false;
+		deliverUnreliable(group, fragmentData.data(), fragmentLength, out);
+	}
+}
@@ -0,0 +1,641 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+// Anything with an fd that wants to be served by the io_uring transport
+class UringHandler {
+public:
+	virtual ~UringHandler() {}
+
+	// bytes arrived, return false to be closed
+	virtual bool onData(const uint8_t* data, size_t size) = 0;
+
+	// copy up to capacity outgoing bytes into buffer, returns how many were copied
+	virtual size_t takeOutgoing(uint8_t* buffer, size_t capacity) = 0;
+
+	// the connection hit EOF or an error and has been unregistered
+	virtual void onClosed() = 0;
+};
+
+// io_uring transport, one ring on one thread serving every registered fd.
+// Reads are multishot recvs into a provided buffer ring, writes go out of registered
+// fixed buffers, and everything queued during one loop iteration is submitted with a
+// single io_uring_enter.
+class Uring {
+
+	enum : unsigned {
+		RING_ENTRIES = 4096,
+		RECV_BUFFERS = 1024, // must be a power of two
+		RECV_BUFFER_SIZE = 4096,
+		SEND_SLOTS = 256, // at most 4096, slot index lives in 12 bits of user_data
+		SEND_SLOT_SIZE = 16384,
+		BUFFER_GROUP = 0,
+	};
+
+	// user_data layout: op:4 | slot:12 | gen:16 | fd:32
+	enum Op : uint64_t {
+		OP_WAKE = 1,
+		OP_RECV,
+		OP_SEND,
+		OP_CANCEL,
+	};
+
+	static uint64_t userData(Op op, unsigned slot, uint32_t gen, int fd) {
+		return ((uint64_t)op << 60) | ((uint64_t)(slot & 0xfff) << 48) | ((uint64_t)(gen & 0xffff) << 32) | (uint32_t)fd;
+	}
+
+	struct Conn {
+		UringHandler* handler = nullptr;
+		uint32_t gen = 0;
+		int sendSlot = -1; // one write in flight at a time keeps bytes in order
+		uint32_t sendDone = 0;
+		uint32_t sendLen = 0;
+		bool waitingForSlot = false;
+	};
+
+	struct Request {
+		enum Kind {
+			ARM,
+			FLUSH,
+			CANCEL,
+		} kind;
+		int fd;
+		uint32_t gen;
+	};
+
+	bool ready = false;
+	int ringfd = -1;
+	int wakefd = -1;
+	uint64_t wakeValue = 0;
+	std::atomic<bool> woken;
+
+	// submission queue
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqArray;
+	unsigned sqMask;
+	unsigned sqEntries;
+	unsigned sqLocalTail;
+	unsigned toSubmit = 0;
+	io_uring_sqe* sqes;
+	std::deque<io_uring_sqe> overflow; // filled in while the queue was full, in order, for the next pass
+
+	// completion queue
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	io_uring_cqe* cqes;
+
+	// provided buffers for recv, the ring's tail overlays the first entry's resv field
+	// (io_uring_buf_ring itself uses a C flex array that C++ lays out differently)
+	io_uring_buf* recvRing = nullptr;
+	uint8_t* recvMemory = nullptr;
+	unsigned recvRingTail = 0;
+
+	// registered fixed buffers for send
+	uint8_t* sendMemory = nullptr;
+	std::vector<int> freeSlots;
+	std::vector<int> slotWaiters; // fds that had something to send when all slots were busy
+
+	// held while processing completions, so once remove() returns the handler is never called again
+	std::mutex connsMutex;
+	std::vector<Conn> conns; // indexed by fd
+	uint32_t nextGen = 1;
+
+	std::mutex pendingMutex;
+	std::vector<Request> pending;
+
+	std::vector<std::pair<void*, size_t>> mappings; // everything setup() mapped, see abandonSetup()
+
+	Uring() : woken(false) {
+		ready = setup();
+		if (!ready) {
+			return;
+		}
+
+		std::thread([this]() { run(); }).detach();
+	}
+
+public:
+	// lives for the whole process, never destroyed so the detached thread can't outlive it
+	static Uring& instance() {
+		static Uring* uring = new Uring();
+		return *uring;
+	}
+
+	Uring(const Uring&) = delete;
+	Uring& operator=(const Uring&) = delete;
+
+	// false if the kernel (or a seccomp policy) wouldn't give us everything we need
+	bool available() const {
+		return ready;
+	}
+
+	// start a multishot recv on fd
+	bool add(int fd, UringHandler* handler) {
+		uint32_t gen;
+		{
+			std::lock_guard<std::mutex> lock(connsMutex);
+
+			if ((size_t)fd >= conns.size()) {
+				conns.resize(fd + 1);
+			}
+			Conn& conn = conns[fd];
+			conn = Conn();
+			conn.handler = handler;
+			conn.gen = gen = nextGen++ & 0xffff;
+		}
+
+		request(Request{ Request::ARM, fd, gen });
+		return true;
+	}
+
+	// stop serving fd, must not be called from a handler callback
+	void remove(int fd) {
+		uint32_t gen;
+		{
+			std::lock_guard<std::mutex> lock(connsMutex);
+			if ((size_t)fd >= conns.size() || !conns[fd].handler) {
+				return;
+			}
+			conns[fd].handler = nullptr;
+			gen = conns[fd].gen;
+		}
+
+		request(Request{ Request::CANCEL, fd, gen });
+	}
+
+	// ask for handler->takeOutgoing() on the ring thread, safe from any thread
+	void schedule(int fd) {
+		request(Request{ Request::FLUSH, fd, 0 });
+	}
+
+private:
+	static int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+	}
+
+	static int registerRing(int fd, unsigned opcode, void* arg, unsigned args) {
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, args);
+	}
+
+	bool setup() {
+		struct io_uring_params params;
+		memset(&params, 0, sizeof params);
+		params.flags = IORING_SETUP_COOP_TASKRUN;
+
+		ringfd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+		if (ringfd == -1) {
+			perror("io_uring_setup");
+			return false;
+		}
+
+		size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) {
+			sqSize = cqSize = std::max(sqSize, cqSize);
+		}
+
+		uint8_t* sq = (uint8_t*)map(sqSize, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+		if (!sq) {
+			perror("mmap sq");
+			return abandonSetup();
+		}
+
+		uint8_t* cq = sq;
+		if (!single) {
+			cq = (uint8_t*)map(cqSize, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+			if (!cq) {
+				perror("mmap cq");
+				return abandonSetup();
+			}
+		}
+
+		sqes = (io_uring_sqe*)map(params.sq_entries * sizeof(io_uring_sqe), MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+		if (!sqes) {
+			perror("mmap sqes");
+			return abandonSetup();
+		}
+
+		sqHead = (unsigned*)(sq + params.sq_off.head);
+		sqTail = (unsigned*)(sq + params.sq_off.tail);
+		sqArray = (unsigned*)(sq + params.sq_off.array);
+		sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+		sqEntries = params.sq_entries;
+		sqLocalTail = *sqTail;
+
+		cqHead = (unsigned*)(cq + params.cq_off.head);
+		cqTail = (unsigned*)(cq + params.cq_off.tail);
+		cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		// provided buffer ring for multishot recv
+		size_t ringSize = RECV_BUFFERS * sizeof(io_uring_buf);
+		recvRing = (io_uring_buf*)map(ringSize, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		recvMemory = (uint8_t*)map(RECV_BUFFERS * RECV_BUFFER_SIZE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (!recvRing || !recvMemory) {
+			perror("mmap recv buffers");
+			return abandonSetup();
+		}
+
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof reg);
+		reg.ring_addr = (uint64_t)(uintptr_t)recvRing;
+		reg.ring_entries = RECV_BUFFERS;
+		reg.bgid = BUFFER_GROUP;
+		if (registerRing(ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+			perror("io_uring register pbuf ring");
+			return abandonSetup();
+		}
+
+		for (unsigned i = 0; i < RECV_BUFFERS; i++) {
+			provideBuffer(i);
+		}
+		publishBuffers();
+
+		// fixed buffers for send
+		sendMemory = (uint8_t*)map(SEND_SLOTS * SEND_SLOT_SIZE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (!sendMemory) {
+			perror("mmap send buffers");
+			return abandonSetup();
+		}
+
+		std::vector<struct iovec> iovecs(SEND_SLOTS);
+		for (unsigned i = 0; i < SEND_SLOTS; i++) {
+			iovecs[i].iov_base = sendMemory + i * SEND_SLOT_SIZE;
+			iovecs[i].iov_len = SEND_SLOT_SIZE;
+			freeSlots.push_back(SEND_SLOTS - 1 - i);
+		}
+		if (registerRing(ringfd, IORING_REGISTER_BUFFERS, iovecs.data(), SEND_SLOTS) == -1) {
+			perror("io_uring register buffers");
+			return abandonSetup();
+		}
+
+		wakefd = eventfd(0, EFD_CLOEXEC);
+		if (wakefd == -1) {
+			perror("eventfd");
+			return abandonSetup();
+		}
+
+		return true;
+	}
+
+	// mmap that abandonSetup() knows to undo, nullptr if it failed
+	void* map(size_t size, int flags, int fd, off_t offset) {
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+		if (p == MAP_FAILED) {
+			return nullptr;
+		}
+		mappings.push_back(std::make_pair(p, size));
+		return p;
+	}
+
+	// undo what setup() got done before failing, so the epoll fallback doesn't run next to a
+	// leaked ring. Closing the ring drops its registered buffers along with it
+	bool abandonSetup() {
+		for (auto& mapping : mappings) {
+			munmap(mapping.first, mapping.second);
+		}
+		mappings.clear();
+		::close(ringfd);
+		ringfd = -1;
+		sqes = nullptr;
+		recvRing = nullptr;
+		recvMemory = nullptr;
+		sendMemory = nullptr;
+		freeSlots.clear();
+		return false;
+	}
+
+	void request(const Request& req) {
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			pending.push_back(req);
+		}
+
+		// only the first request since the last wakeup pays for the syscall
+		if (!woken.exchange(true)) {
+			uint64_t one = 1;
+			if (::write(wakefd, &one, sizeof one) == -1) {
+				perror("eventfd write");
+			}
+		}
+	}
+
+	// ---- ring plumbing (ring thread only) ----
+
+	bool sqFull() const {
+		return sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries;
+	}
+
+	// never fails, when the kernel can't take more yet the entry waits in overflow
+	io_uring_sqe* getSqe() {
+		if (sqFull()) {
+			submit(0);
+			queueOverflow();
+		}
+
+		if (!overflow.empty() || sqFull()) {
+			overflow.emplace_back();
+			memset(&overflow.back(), 0, sizeof overflow.back());
+			return &overflow.back();
+		}
+
+		io_uring_sqe* sqe = claimSqe();
+		memset(sqe, 0, sizeof *sqe);
+		return sqe;
+	}
+
+	io_uring_sqe* claimSqe() {
+		unsigned index = sqLocalTail & sqMask;
+		sqArray[index] = index;
+		sqLocalTail++;
+		toSubmit++;
+		return &sqes[index];
+	}
+
+	// move what overflowed into the queue, as much as fits
+	void queueOverflow() {
+		while (!overflow.empty() && !sqFull()) {
+			*claimSqe() = overflow.front();
+			overflow.pop_front();
+		}
+	}
+
+	void submit(unsigned waitFor) {
+		__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+		while (true) {
+			int n = enter(ringfd, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+			if (n >= 0) {
+				toSubmit -= std::min((unsigned)n, toSubmit);
+				return;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EBUSY) {
+				// completion queue is backed up, let the caller reap first
+				return;
+			}
+			perror("io_uring_enter");
+			return;
+		}
+	}
+
+	void provideBuffer(unsigned bid) {
+		io_uring_buf* buf = &recvRing[recvRingTail & (RECV_BUFFERS - 1)];
+		buf->addr = (uint64_t)(uintptr_t)(recvMemory + bid * RECV_BUFFER_SIZE);
+		buf->len = RECV_BUFFER_SIZE;
+		buf->bid = bid;
+		recvRingTail++;
+	}
+
+	void publishBuffers() {
+		__atomic_store_n(&recvRing[0].resv, (uint16_t)recvRingTail, __ATOMIC_RELEASE);
+	}
+
+	void armWake() {
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = wakefd;
+		sqe->addr = (uint64_t)(uintptr_t)&wakeValue;
+		sqe->len = sizeof wakeValue;
+		sqe->user_data = userData(OP_WAKE, 0, 0, 0);
+	}
+
+	void armRecv(int fd, uint32_t gen) {
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = fd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BUFFER_GROUP;
+		sqe->user_data = userData(OP_RECV, 0, gen, fd);
+	}
+
+	void submitSend(int fd, const Conn& conn) {
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)(sendMemory + conn.sendSlot * SEND_SLOT_SIZE + conn.sendDone);
+		sqe->len = conn.sendLen - conn.sendDone;
+		sqe->buf_index = conn.sendSlot;
+		sqe->user_data = userData(OP_SEND, conn.sendSlot, conn.gen, fd);
+	}
+
+	void cancelRecv(int fd, uint32_t gen) {
+		io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = userData(OP_RECV, 0, gen, fd);
+		sqe->user_data = userData(OP_CANCEL, 0, gen, fd);
+	}
+
+	// ---- connection logic (ring thread, connsMutex held) ----
+
+	Conn* connFor(int fd, uint32_t gen) {
+		if ((size_t)fd >= conns.size()) {
+			return nullptr;
+		}
+		Conn& conn = conns[fd];
+		return conn.handler && conn.gen == gen ? &conn : nullptr;
+	}
+
+	void close(int fd, Conn& conn) {
+		UringHandler* handler = conn.handler;
+		conn.handler = nullptr;
+		cancelRecv(fd, conn.gen);
+		handler->onClosed();
+	}
+
+	void releaseSlot(int slot) {
+		freeSlots.push_back(slot);
+
+		while (!freeSlots.empty() && !slotWaiters.empty()) {
+			int fd = slotWaiters.back();
+			slotWaiters.pop_back();
+
+			if ((size_t)fd < conns.size() && conns[fd].handler) {
+				conns[fd].waitingForSlot = false;
+				flush(fd, conns[fd]);
+			}
+		}
+	}
+
+	void flush(int fd, Conn& conn) {
+		if (conn.sendSlot != -1 || conn.waitingForSlot) {
+			return; // the in flight write or the slot release will bring us back
+		}
+
+		if (freeSlots.empty()) {
+			conn.waitingForSlot = true;
+			slotWaiters.push_back(fd);
+			return;
+		}
+
+		int slot = freeSlots.back();
+		size_t n = conn.handler->takeOutgoing(sendMemory + slot * SEND_SLOT_SIZE, SEND_SLOT_SIZE);
+		if (n == 0) {
+			return;
+		}
+
+		freeSlots.pop_back();
+		conn.sendSlot = slot;
+		conn.sendDone = 0;
+		conn.sendLen = n;
+		submitSend(fd, conn);
+	}
+
+	void complete(const io_uring_cqe& cqe) {
+		Op op = (Op)(cqe.user_data >> 60);
+		int slot = (cqe.user_data >> 48) & 0xfff;
+		uint32_t gen = (cqe.user_data >> 32) & 0xffff;
+		int fd = (int)(uint32_t)cqe.user_data;
+
+		switch (op) {
+			case OP_WAKE: {
+				// clear before taking the list so a racing request() signals again
+				woken = false;
+
+				std::vector<Request> requests;
+				{
+					std::lock_guard<std::mutex> lock(pendingMutex);
+					requests.swap(pending);
+				}
+
+				for (const Request& req : requests) {
+					switch (req.kind) {
+						case Request::ARM: {
+							if (connFor(req.fd, req.gen)) {
+								armRecv(req.fd, req.gen);
+							}
+							break;
+						}
+						case Request::FLUSH: {
+							if ((size_t)req.fd < conns.size() && conns[req.fd].handler) {
+								flush(req.fd, conns[req.fd]);
+							}
+							break;
+						}
+						case Request::CANCEL: {
+							cancelRecv(req.fd, req.gen);
+							break;
+						}
+					}
+				}
+
+				armWake();
+				break;
+			}
+
+			case OP_RECV: {
+				Conn* conn = connFor(fd, gen);
+				bool more = cqe.flags & IORING_CQE_F_MORE;
+
+				if (cqe.flags & IORING_CQE_F_BUFFER) {
+					unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+					if (conn && cqe.res > 0 && !conn->handler->onData(recvMemory + bid * RECV_BUFFER_SIZE, cqe.res)) {
+						close(fd, *conn);
+						conn = nullptr;
+					}
+					provideBuffer(bid);
+					publishBuffers();
+				}
+
+				if (!conn || more) {
+					break;
+				}
+
+				if (cqe.res > 0 || cqe.res == -ENOBUFS) {
+					armRecv(fd, gen); // multishot ended early, keep reading
+				} else {
+					if (cqe.res < 0 && cqe.res != -ECANCELED) {
+						errno = -cqe.res;
+						perror("recv");
+					}
+					close(fd, *conn);
+				}
+				break;
+			}
+
+			case OP_SEND: {
+				Conn* conn = connFor(fd, gen);
+				if (!conn) {
+					releaseSlot(slot);
+					break;
+				}
+
+				if (cqe.res <= 0) {
+					if (cqe.res < 0) {
+						errno = -cqe.res;
+						perror("send");
+					}
+					conn->sendSlot = -1;
+					close(fd, *conn);
+					releaseSlot(slot);
+					break;
+				}
+
+				conn->sendDone += cqe.res;
+				if (conn->sendDone < conn->sendLen) {
+					submitSend(fd, *conn); // partial write, send the rest
+					break;
+				}
+
+				conn->sendSlot = -1;
+				releaseSlot(slot);
+				flush(fd, *conn);
+				break;
+			}
+
+			case OP_CANCEL: {
+				break;
+			}
+		}
+	}
+
+	void run() {
+		armWake();
+
+		while (true) {
+			// everything queued since the last iteration goes to the kernel in one call,
+			// along with whatever didn't fit last time now that completions have been reaped
+			queueOverflow();
+			submit(1);
+
+			std::lock_guard<std::mutex> lock(connsMutex);
+
+			unsigned head = *cqHead;
+			unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+			while (head != tail) {
+				complete(cqes[head & cqMask]);
+				head++;
+
+				if (head == tail) {
+					__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+					tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+				}
+			}
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+		}
+	}
+};
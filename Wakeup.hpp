@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "Socket.hpp"
+
+// Lets one thread sleep until another has something for it, the lobby for instance, woken by
+// the acceptor and by its clients' sockets. A wake while nobody is waiting isn't lost, the
+// next wait returns right away, and wakes that pile up before then cost one notify.
+class Wakeup : public Socket::Listener {
+public:
+	Wakeup() : pending(false) {}
+
+	Wakeup(const Wakeup&) = delete;
+	Wakeup& operator=(const Wakeup&) = delete;
+
+	// any thread
+	void wake() {
+		if (pending.exchange(true)) {
+			return; // the waiter hasn't picked up the last one yet, it'll see this too
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		changed.notify_one();
+	}
+
+	void onSocketActivity() override {
+		wake();
+	}
+
+	// false if timeout passed without a wake
+	template <typename Rep, typename Period>
+	bool waitFor(std::chrono::duration<Rep, Period> timeout) {
+		std::unique_lock<std::mutex> lock(mutex);
+		bool woken = changed.wait_for(lock, timeout, [this]() { return pending.load(); });
+		pending = false;
+		return woken;
+	}
+
+private:
+	std::atomic<bool> pending;
+	std::mutex mutex;
+	std::condition_variable changed;
+};
@@ -0,0 +1,390 @@
+// Micro-benchmarks for the packet, framing, socket and queue hot paths.
+//
+//   g++ -std=c++11 -O2 bench.cpp -o bench -pthread
+//   ./bench > before.jsonl
+//
+// One JSON object per line and benchmark, so runs can be diffed or loaded into anything:
+//   {"name":..., "ops":N, "ns_per_op":..., "ops_per_sec":...} plus p50/p90/p99/max_ns for
+//   benchmarks that time single operations.
+//
+// --filter=TEXT   only run benchmarks with TEXT in their name
+// --scale=X       multiply every iteration count, 0.1 for a quick run (default 1)
+// --cpus=A,B      cores the two sides of cross thread benchmarks are pinned to (default 0,1)
+
+#include "Framing.hpp"
+#include "Histogram.hpp"
+#include "Socket.hpp"
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "queue/readerwriterqueue.h"
+
+using moodycamel::BlockingReaderWriterQueue;
+using moodycamel::ReaderWriterQueue;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	std::string filter;
+	double scale = 1.0;
+	int cpus[2] = {0, 1};
+};
+
+static Options options;
+
+// keeps the optimizer from dropping work whose result nothing reads
+static volatile uint64_t sink;
+
+static size_t iterations(size_t n) {
+	return std::max<size_t>(1, size_t(n * options.scale));
+}
+
+static bool selected(const std::string& name) {
+	return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// the calling thread, onto one of --cpus, so cross thread numbers mean cross core
+static void pin(int side) {
+	int cpus = std::max(1u, std::thread::hardware_concurrency());
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(options.cpus[side] % cpus, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof set, &set) != 0) {
+		perror("pthread_setaffinity_np");
+	}
+}
+
+static void unpin() {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()); c++) {
+		CPU_SET(c, &set);
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+}
+
+static void result(const std::string& name, uint64_t ops, Clock::duration elapsed, const Histogram* latency = nullptr,
+		const std::string& extra = "") {
+	double ns = double(Histogram::nanoseconds(elapsed));
+	std::ostringstream s;
+	s << std::fixed << std::setprecision(2)
+		<< "{\"name\":\"" << name << "\",\"ops\":" << ops
+		<< ",\"ns_per_op\":" << ns / ops << ",\"ops_per_sec\":" << (ns > 0 ? ops * 1e9 / ns : 0.0);
+	if (latency) {
+		s << ",\"p50_ns\":" << latency->percentile(0.5) << ",\"p90_ns\":" << latency->percentile(0.9)
+			<< ",\"p99_ns\":" << latency->percentile(0.99) << ",\"max_ns\":" << latency->maximum();
+	}
+	s << extra << "}";
+	std::cout << s.str() << std::endl;
+}
+
+// times n calls of op back to back
+static void run(const std::string& name, size_t n, const std::function<void()>& op) {
+	if (!selected(name)) {
+		return;
+	}
+	n = iterations(n);
+	for (size_t i = 0; i < n / 10; i++) { // warm the pool and caches
+		op();
+	}
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < n; i++) {
+		op();
+	}
+	result(name, n, Clock::now() - start);
+}
+
+static void packets() {
+	run("packet.pack.initializer_list", 2000000, []() {
+		Packet* packet = Packet::pack(MessageType::STAGING_ROLE_CHANGE, {3, 2});
+		sink = packet->payload.size();
+		packet->release();
+	});
+
+	std::vector<uint8_t> small = {3, 1, 0, 2, 1, 1};
+	run("packet.pack.vector.6B", 2000000, [&]() {
+		Packet* packet = Packet::pack(MessageType::STAGING_PLAYER_SYNC, small);
+		sink = packet->payload.size();
+		packet->release();
+	});
+
+	std::vector<uint8_t> snapshot(300, 0x5a); // about what a budgeted snapshot comes to
+	run("packet.pack.vector.300B", 2000000, [&]() {
+		Packet* packet = Packet::pack(MessageType::SNAPSHOT, snapshot);
+		sink = packet->payload.size();
+		packet->release();
+	});
+}
+
+static void framing() {
+	const uint32_t lengths[] = {2, 200, 1187, 70000};
+	const char* framings[] = {"legacy", "varint"};
+
+	for (int f = 0; f < 2; f++) {
+		Framing framing = f ? Framing::VARINT : Framing::LEGACY;
+		for (uint32_t length : lengths) {
+			uint8_t head[FrameHeader::MAX_SIZE];
+			if (FrameHeader::encode(framing, length, head) == 0) {
+				continue; // legacy can't frame it
+			}
+
+			std::string suffix = std::string(framings[f]) + "." + std::to_string(length) + "B";
+			run("frame.encode." + suffix, 10000000, [&]() {
+				sink = FrameHeader::encode(framing, length, head);
+			});
+
+			RecvBuffer buffer;
+			buffer.append(head, FrameHeader::encode(framing, length, head));
+			run("frame.decode." + suffix, 10000000, [&]() {
+				uint32_t decoded;
+				sink = FrameHeader::decode(framing, buffer, decoded) + decoded;
+			});
+		}
+	}
+}
+
+// a connected pair of Sockets on the epoll reactor, frames enqueued on one come out the other's readQueue
+static void sockets() {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		perror("socketpair");
+		return;
+	}
+	std::unique_ptr<Socket> a(new Socket(fds[0]));
+	std::unique_ptr<Socket> b(new Socket(fds[1]));
+
+	auto take = [&]() {
+		Packet* packet;
+		while (!b->readQueue.try_dequeue(packet)) {
+			std::this_thread::yield();
+		}
+		sink = packet->payload.size();
+		packet->release();
+	};
+
+	// one frame at a time, enqueue to dequeued on the far side: the reactor's wake, send, recv and split
+	if (selected("socket.latency")) {
+		size_t n = iterations(50000);
+		Histogram latency;
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < n; i++) {
+			Clock::time_point sent = Clock::now();
+			a->writeQueue.enqueue(Packet::pack(MessageType::STAGING_ROLE_CHANGE, {1, 2}));
+			take();
+			latency.record(Histogram::nanoseconds(Clock::now() - sent));
+		}
+		result("socket.latency", n, Clock::now() - start, &latency);
+	}
+
+	// keep a window of frames in flight so sends batch the way a busy room's do
+	std::vector<uint8_t> payload(200, 0x5a);
+	if (selected("socket.throughput.200B")) {
+		size_t n = iterations(500000);
+		const size_t WINDOW = 64;
+		size_t sent = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t received = 0; received < n; received++) {
+			while (sent < n && sent - received < WINDOW) {
+				a->writeQueue.enqueue(Packet::pack(MessageType::SNAPSHOT, payload));
+				sent++;
+			}
+			take();
+		}
+		TrafficStats stats = a->stats();
+		result("socket.throughput.200B", n, Clock::now() - start, nullptr,
+			",\"frames_per_send\":" + std::to_string(double(stats.framesOut) / std::max<uint64_t>(1, stats.sendCalls)));
+	}
+}
+
+// producer on one core, consumer on the other
+template <typename Queue, typename Dequeue>
+static void queueThroughput(const std::string& name, Dequeue dequeue) {
+	if (!selected(name)) {
+		return;
+	}
+	size_t n = iterations(10000000);
+	Queue queue(1024);
+
+	std::thread consumer([&]() {
+		pin(1);
+		uint64_t sum = 0;
+		for (size_t i = 0; i < n; i++) {
+			uint64_t value;
+			dequeue(queue, value);
+			sum += value;
+		}
+		sink = sum;
+	});
+
+	pin(0);
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < n; i++) {
+		queue.enqueue(i);
+	}
+	consumer.join();
+	Clock::duration elapsed = Clock::now() - start;
+	unpin();
+	result(name, n, elapsed);
+}
+
+// one value bouncing between cores over a queue each way, latency is half the round trip
+template <typename Queue, typename Dequeue>
+static void queueLatency(const std::string& name, Dequeue dequeue) {
+	if (!selected(name)) {
+		return;
+	}
+	size_t n = iterations(200000);
+	Queue ping(16), pong(16);
+
+	std::thread echo([&]() {
+		pin(1);
+		for (size_t i = 0; i < n; i++) {
+			uint64_t value;
+			dequeue(ping, value);
+			pong.enqueue(value);
+		}
+	});
+
+	pin(0);
+	Histogram latency;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < n; i++) {
+		Clock::time_point sent = Clock::now();
+		ping.enqueue(i);
+		uint64_t value;
+		dequeue(pong, value);
+		latency.record(Histogram::nanoseconds(Clock::now() - sent) / 2);
+	}
+	echo.join();
+	Clock::duration elapsed = Clock::now() - start;
+	unpin();
+	result(name, n, elapsed, &latency);
+}
+
+static void queues() {
+	// the game loop polls its ReaderWriterQueues, so the consumer spins on try_dequeue
+	auto poll = [](ReaderWriterQueue<uint64_t>& queue, uint64_t& value) {
+		while (!queue.try_dequeue(value)) {
+			std::this_thread::yield();
+		}
+	};
+	auto wait = [](BlockingReaderWriterQueue<uint64_t>& queue, uint64_t& value) {
+		queue.wait_dequeue(value);
+	};
+
+	queueThroughput<ReaderWriterQueue<uint64_t>>("queue.rwq.throughput", poll);
+	queueThroughput<BlockingReaderWriterQueue<uint64_t>>("queue.blocking_rwq.throughput", wait);
+	queueLatency<ReaderWriterQueue<uint64_t>>("queue.rwq.latency", poll);
+	queueLatency<BlockingReaderWriterQueue<uint64_t>>("queue.blocking_rwq.latency", wait);
+}
+
+// Room::broadcast to a staging room of n clients: one packet, retained into every client's
+// write queue, timed from pack until every client has the frame off the wire
+static void broadcast(size_t clients) {
+	std::string name = "broadcast.staging." + std::to_string(clients);
+	if (!selected(name)) {
+		return;
+	}
+
+	std::vector<std::unique_ptr<Socket>> sockets;
+	std::vector<int> peers;
+	for (size_t c = 0; c < clients; c++) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+			perror("socketpair");
+			return;
+		}
+		sockets.emplace_back(new Socket(fds[0]));
+		peers.push_back(fds[1]);
+	}
+
+	size_t n = iterations(20000 / clients + 100);
+	Histogram enqueue, wire;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < n; i++) {
+		Clock::time_point begin = Clock::now();
+		Packet* packet = Packet::pack(MessageType::STAGING_ROLE_CHANGE, {1, 2});
+		for (auto& socket : sockets) {
+			socket->writeQueue.enqueue(packet->retain());
+		}
+		packet->release();
+		enqueue.record(Histogram::nanoseconds(Clock::now() - begin));
+
+		// legacy header plus three bytes of payload
+		for (int peer : peers) {
+			uint8_t frame[4];
+			size_t got = 0;
+			while (got < sizeof frame) {
+				ssize_t r = ::recv(peer, frame + got, sizeof frame - got, 0);
+				if (r <= 0) {
+					perror("recv");
+					return;
+				}
+				got += r;
+			}
+		}
+		wire.record(Histogram::nanoseconds(Clock::now() - begin));
+	}
+	Clock::duration elapsed = Clock::now() - start;
+
+	// the game loop's share, then all the way to the last client
+	std::ostringstream extra;
+	extra << ",\"clients\":" << clients << ",\"enqueue_p50_ns\":" << enqueue.percentile(0.5)
+		<< ",\"enqueue_p99_ns\":" << enqueue.percentile(0.99);
+	result(name, n, elapsed, &wire, extra.str());
+
+	for (int peer : peers) {
+		::close(peer);
+	}
+}
+
+int main(int argc, char** argv) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 9, "--filter=") == 0) {
+			options.filter = arg.substr(9);
+		} else if (arg.compare(0, 8, "--scale=") == 0) {
+			options.scale = std::stod(arg.substr(8));
+		} else if (arg.compare(0, 7, "--cpus=") == 0) {
+			std::string cpus = arg.substr(7);
+			size_t comma = cpus.find(',');
+			options.cpus[0] = std::stoi(cpus.substr(0, comma));
+			options.cpus[1] = comma == std::string::npos ? options.cpus[0] : std::stoi(cpus.substr(comma + 1));
+		} else {
+			std::cout << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	// the biggest broadcast holds two fds per client
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	Socket::useBackend(Socket::Backend::EPOLL);
+
+	packets();
+	framing();
+	sockets();
+	queues();
+	for (size_t clients : {3, 64, 1024}) {
+		broadcast(clients);
+	}
+	return 0;
+}
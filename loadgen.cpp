@@ -0,0 +1,546 @@
+// Headless bots for load testing: connections that join rooms, go through staging and stream
+// INPUT the way players would, and report how quickly the server answers.
+//
+//   g++ -std=c++11 -O2 loadgen.cpp -o loadgen -pthread
+//   ./loadgen --bots=3000 --duration=60
+//
+// --host=ADDR        server address (default 127.0.0.1)
+// --port=N           (default 3490)
+// --bots=N           connections (default 100)
+// --threads=N        event loops the bots are spread over (default 1)
+// --input-hz=N       INPUT frames per second per bot once in game (default 60)
+// --connect-rate=N   new connections per second (default 500)
+// --duration=N       seconds to run once every bot has been started (default 30)
+//
+// Latencies are connect to JOIN_ROOM echo, and INPUT sent to the first SNAPSHOT acking it.
+// Bots only speak TCP, INPUT goes over the same connection rather than UDP.
+
+#include "Framing.hpp"
+#include "Histogram.hpp"
+#include "Input.hpp"
+#include "Protocol.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	std::string host = "127.0.0.1";
+	int port = 3490;
+	unsigned bots = 100;
+	unsigned threads = 1;
+	unsigned inputHz = 60;
+	unsigned connectRate = 500;
+	unsigned duration = 30;
+};
+
+// shared by every event loop, read by the reporter
+struct Totals {
+	std::atomic<uint64_t> connected{0};
+	std::atomic<uint64_t> connectFailures{0};
+	std::atomic<uint64_t> joined{0};
+	std::atomic<uint64_t> rejected{0}; // JOIN_ROOM_REJECTION
+	std::atomic<uint64_t> inGame{0};
+	std::atomic<uint64_t> disconnects{0}; // the server hung up or the connection broke
+	std::atomic<uint64_t> bytesIn{0};
+	std::atomic<uint64_t> bytesOut{0};
+	std::atomic<uint64_t> framesIn{0};
+	std::atomic<uint64_t> framesOut{0};
+	std::atomic<uint64_t> snapshots{0};
+	std::atomic<uint64_t> inputs{0};
+	Histogram joinLatency;
+	Histogram inputLatency;
+};
+
+static Totals totals;
+
+class Bot {
+public:
+	enum State {
+		CONNECTING,
+		LOBBY, // JOIN_ROOM sent
+		STAGING,
+		IN_GAME,
+		CLOSED,
+	};
+
+	explicit Bot(unsigned index) : index(index) {}
+
+	~Bot() {
+		close(false);
+	}
+
+	bool connect(const sockaddr_in& address, int epoll) {
+		fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd == -1) {
+			perror("socket");
+			return false;
+		}
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one); // INPUT is small and can't wait
+
+		if (::connect(fd, (const sockaddr*)&address, sizeof address) == -1 && errno != EINPROGRESS) {
+			perror("connect");
+			::close(fd);
+			fd = -1;
+			return false;
+		}
+
+		epoll_event event;
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = this;
+		if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+			perror("epoll_ctl");
+			::close(fd);
+			fd = -1;
+			return false;
+		}
+
+		started = Clock::now();
+		return true;
+	}
+
+	// returns false once the bot is done for
+	bool onEvents(uint32_t events, Clock::time_point now) {
+		if (state == CONNECTING && events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+			int error = 0;
+			socklen_t size = sizeof error;
+			getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size);
+			if (error) {
+				totals.connectFailures++;
+				close(false);
+				return false;
+			}
+
+			totals.connected++;
+			state = LOBBY;
+			send({MessageType::JOIN_ROOM}); // matched, rooms only exist once the server made them
+			send({MessageType::FRAMING_VARINT});
+		}
+
+		if (events & EPOLLIN && !read(now)) {
+			close(true);
+			return false;
+		}
+		if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			close(true);
+			return false;
+		}
+		if (events & EPOLLOUT && !flush()) {
+			close(true);
+			return false;
+		}
+		return true;
+	}
+
+	// staging keeps voting until everyone is ready, the server ignores the early ones
+	bool vote(Clock::time_point now) {
+		if (state == STAGING && now - lastVote > std::chrono::milliseconds(500)) {
+			lastVote = now;
+			send({MessageType::STAGING_VOTE_TO_START});
+		}
+		return flushOrClose();
+	}
+
+	// one INPUT frame carrying this tick's command and the two before it
+	bool input(Clock::time_point now, double seconds) {
+		if (state != IN_GAME) {
+			return true;
+		}
+
+		// run circles, each bot a little out of phase, cops reaching for a tag every couple of seconds
+		double angle = seconds * 1.5 + index * 0.7;
+		InputCommand command;
+		command.moveX = (int8_t)std::lround(127.0 * std::cos(angle));
+		command.moveZ = (int8_t)std::lround(127.0 * std::sin(angle));
+		command.yaw = uint16_t(angle / (2.0 * M_PI) * 65536.0);
+		command.buttons = role == Protocol::COP && sequence % 120 == 0 ? InputCommand::TAG : 0;
+
+		sequence++;
+		recent[2] = recent[1];
+		recent[1] = recent[0];
+		recent[0] = command;
+		sentAt[sequence % SENT_WINDOW] = Sent{sequence, now};
+
+		uint8_t count = std::min<uint32_t>(sequence, 3);
+		std::vector<uint8_t> payload = {
+			MessageType::INPUT, uint8_t(sequence), uint8_t(sequence >> 8), uint8_t(sequence >> 16), uint8_t(sequence >> 24), count
+		};
+		for (uint8_t k = 0; k < count; k++) {
+			const InputCommand& c = recent[k];
+			payload.insert(payload.end(), {uint8_t(c.moveX), uint8_t(c.moveZ), uint8_t(c.yaw), uint8_t(c.yaw >> 8), c.buttons});
+		}
+		send(payload);
+		totals.inputs++;
+		return flushOrClose();
+	}
+
+	State getState() const {
+		return state;
+	}
+
+private:
+	enum : uint32_t { SENT_WINDOW = 256 }; // INPUTs we remember the send time of
+
+	struct Sent {
+		uint32_t sequence; // 0 until used, the first INPUT is 1
+		Clock::time_point at;
+	};
+
+	unsigned index;
+	int fd = -1;
+	State state = CONNECTING;
+	Framing readFraming = Framing::LEGACY; // switches at the server's echo
+	Framing writeFraming = Framing::LEGACY; // switches right after our request, like the server reads
+	uint8_t role = Protocol::ROBBER; // asked for, a rejection makes it a cop
+
+	RecvBuffer in;
+	std::vector<uint8_t> frame; // scratch for one payload
+	std::vector<uint8_t> out;
+	size_t outSent = 0;
+
+	Clock::time_point started;
+	Clock::time_point lastVote;
+	uint32_t sequence = 0;
+	uint32_t acked = 0; // newest INPUT a snapshot said was applied
+	InputCommand recent[3];
+	Sent sentAt[SENT_WINDOW] = {};
+
+	void send(const std::vector<uint8_t>& payload) {
+		uint8_t head[FrameHeader::MAX_SIZE];
+		size_t headSize = FrameHeader::encode(writeFraming, payload.size(), head);
+		out.insert(out.end(), head, head + headSize);
+		out.insert(out.end(), payload.begin(), payload.end());
+		if (payload.size() == 1 && payload[0] == MessageType::FRAMING_VARINT) {
+			writeFraming = Framing::VARINT;
+		}
+		totals.framesOut++;
+	}
+
+	// write as much of out as the socket takes, false if the connection is gone
+	bool flush() {
+		while (outSent < out.size()) {
+			ssize_t n = ::send(fd, out.data() + outSent, out.size() - outSent, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return errno == EAGAIN || errno == EWOULDBLOCK; // EPOLLOUT brings us back
+			}
+			outSent += n;
+			totals.bytesOut += n;
+		}
+		out.clear();
+		outSent = 0;
+		return true;
+	}
+
+	bool flushOrClose() {
+		if (state == CONNECTING || state == CLOSED) {
+			return state != CLOSED;
+		}
+		if (!flush()) {
+			close(true);
+			return false;
+		}
+		return true;
+	}
+
+	bool read(Clock::time_point now) {
+		while (true) {
+			size_t wanted;
+			ssize_t n = in.readFrom(fd, wanted);
+			if (n == 0) {
+				return false;
+			}
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					in.trim();
+					return true;
+				}
+				return false;
+			}
+			totals.bytesIn += n;
+
+			while (!in.empty()) {
+				uint32_t length;
+				int headSize = FrameHeader::decode(readFraming, in, length);
+				if (headSize < 0 || headSize + length > RecvBuffer::DEFAULT_CAPACITY) {
+					std::cout << "bot " << index << ": bad frame from server" << std::endl;
+					return false;
+				}
+				if (headSize == 0 || in.size() < headSize + length) {
+					break;
+				}
+
+				frame.resize(length);
+				in.consume(headSize);
+				in.copyOut(0, frame.data(), length);
+				in.consume(length);
+				totals.framesIn++;
+				handle(frame, now);
+			}
+		}
+	}
+
+	void handle(const std::vector<uint8_t>& payload, Clock::time_point now) {
+		switch (payload[0]) {
+			case MessageType::JOIN_ROOM: {
+				totals.joined++;
+				totals.joinLatency.record(Histogram::nanoseconds(now - started));
+				state = STAGING;
+				send({MessageType::STAGING_ROLE_CHANGE, role});
+				break;
+			}
+
+			case MessageType::JOIN_ROOM_REJECTION: {
+				totals.rejected++;
+				state = CLOSED;
+				break;
+			}
+
+			case MessageType::FRAMING_VARINT: {
+				readFraming = Framing::VARINT;
+				break;
+			}
+
+			case MessageType::STAGING_ROLE_CHANGE_REJECTION: {
+				role = Protocol::COP;
+				send({MessageType::STAGING_ROLE_CHANGE, role});
+				break;
+			}
+
+			case MessageType::STAGING_START_GAME: {
+				if (state != IN_GAME) {
+					state = IN_GAME;
+					totals.inGame++;
+				}
+				break;
+			}
+
+			case MessageType::SNAPSHOT: {
+				totals.snapshots++;
+				if (payload.size() < 13) {
+					break;
+				}
+				send({MessageType::SNAPSHOT_ACK, payload[1], payload[2], payload[3], payload[4]});
+
+				uint32_t applied = payload[9] | payload[10] << 8 | payload[11] << 16 | uint32_t(payload[12]) << 24;
+				for (uint32_t s = std::max(acked + 1, sequence > SENT_WINDOW ? sequence - SENT_WINDOW + 1 : 1); s <= applied && s <= sequence; s++) {
+					if (sentAt[s % SENT_WINDOW].sequence == s) {
+						totals.inputLatency.record(Histogram::nanoseconds(now - sentAt[s % SENT_WINDOW].at));
+					}
+				}
+				acked = std::max(acked, applied);
+				break;
+			}
+
+			default: {
+				break; // staging chatter the bot doesn't care about
+			}
+		}
+	}
+
+	void close(bool broken) {
+		if (fd == -1) {
+			return;
+		}
+		if (broken && state != CLOSED) {
+			totals.disconnects++;
+		}
+		if (state == IN_GAME) {
+			totals.inGame--;
+		}
+		::close(fd);
+		fd = -1;
+		state = CLOSED;
+	}
+};
+
+// one epoll loop driving every threads-th bot
+static void runBots(const Options& options, const sockaddr_in& address, unsigned thread, Clock::time_point end,
+		const std::atomic<bool>& stop) {
+	int epoll = epoll_create1(0);
+	if (epoll == -1) {
+		perror("epoll_create1");
+		exit(1);
+	}
+
+	std::vector<std::unique_ptr<Bot>> bots;
+	for (unsigned i = thread; i < options.bots; i += options.threads) {
+		bots.emplace_back(new Bot(i));
+	}
+
+	Clock::time_point begin = Clock::now();
+	Clock::duration connectEvery = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) * options.threads / options.connectRate;
+	Clock::duration inputEvery = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / options.inputHz;
+	Clock::time_point nextConnect = begin;
+	Clock::time_point nextInput = begin;
+	size_t started = 0;
+
+	epoll_event events[256];
+	while (!stop && Clock::now() < end) {
+		Clock::time_point now = Clock::now();
+
+		while (started < bots.size() && nextConnect <= now) {
+			if (!bots[started]->connect(address, epoll)) {
+				totals.connectFailures++;
+			}
+			started++;
+			nextConnect += connectEvery;
+		}
+
+		if (nextInput <= now) {
+			double seconds = std::chrono::duration<double>(now - begin).count();
+			for (auto& bot : bots) {
+				bot->input(now, seconds);
+				bot->vote(now);
+			}
+
+			// a loop that fell behind skips ticks rather than bursting to catch up
+			nextInput += inputEvery;
+			if (nextInput < now) {
+				nextInput = now + inputEvery;
+			}
+		}
+
+		Clock::time_point wake = std::min(nextInput, started < bots.size() ? nextConnect : nextInput);
+		int timeout = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count());
+		int n = epoll_wait(epoll, events, 256, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			exit(1);
+		}
+
+		now = Clock::now();
+		for (int i = 0; i < n; i++) {
+			static_cast<Bot*>(events[i].data.ptr)->onEvents(events[i].events, now);
+		}
+	}
+
+	bots.clear(); // closes every connection
+	::close(epoll);
+}
+
+static void report(double seconds, const Options& options, uint64_t (&last)[5], bool final) {
+	uint64_t now[5] = {totals.bytesIn, totals.bytesOut, totals.framesIn, totals.framesOut, totals.snapshots};
+	double rate[5];
+	for (int i = 0; i < 5; i++) {
+		rate[i] = double(now[i] - last[i]);
+		last[i] = now[i];
+	}
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< "t=" << seconds << "s connected " << totals.connected << "/" << options.bots
+		<< ", joined " << totals.joined << ", in game " << totals.inGame
+		<< ", rejected " << totals.rejected << ", connect failures " << totals.connectFailures
+		<< ", disconnects " << totals.disconnects << "\n"
+		<< "  in " << rate[0] / 1024 << " KiB/s " << rate[2] << " frames/s (" << rate[4] << " snapshots/s)"
+		<< ", out " << rate[1] / 1024 << " KiB/s " << rate[3] << " frames/s\n";
+
+	const Histogram* latencies[] = {&totals.joinLatency, &totals.inputLatency};
+	const char* names[] = {"join", "input"};
+	for (int i = 0; i < 2; i++) {
+		const Histogram& h = *latencies[i];
+		std::cout << std::setprecision(2) << "  " << names[i] << " latency ms: p50 " << h.percentile(0.5) / 1e6
+			<< " p90 " << h.percentile(0.9) / 1e6 << " p99 " << h.percentile(0.99) / 1e6;
+		if (final) {
+			std::cout << " p99.9 " << h.percentile(0.999) / 1e6 << " max " << h.maximum() / 1e6 << " (" << h.count() << " samples)";
+		}
+		std::cout << "\n";
+	}
+	std::cout << std::flush;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		size_t eq = arg.find('=');
+		std::string name = arg.substr(0, eq);
+		std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+		if (name == "--host") {
+			options.host = value;
+		} else if (name == "--port") {
+			options.port = std::stoi(value);
+		} else if (name == "--bots") {
+			options.bots = std::stoi(value);
+		} else if (name == "--threads") {
+			options.threads = std::max(1, std::stoi(value));
+		} else if (name == "--input-hz") {
+			options.inputHz = std::max(1, std::stoi(value));
+		} else if (name == "--connect-rate") {
+			options.connectRate = std::max(1, std::stoi(value));
+		} else if (name == "--duration") {
+			options.duration = std::stoi(value);
+		} else {
+			std::cout << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(options.port);
+	if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1) {
+		std::cout << "Bad host: " << options.host << std::endl;
+		return 1;
+	}
+
+	// thousands of connections need the fds for them
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	Clock::time_point begin = Clock::now();
+	Clock::time_point end = begin + std::chrono::seconds(options.bots / options.connectRate + 1 + options.duration);
+	std::atomic<bool> stop(false);
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < options.threads; t++) {
+		threads.emplace_back([&, t]() { runBots(options, address, t, end, stop); });
+	}
+
+	uint64_t last[5] = {};
+	Clock::time_point next = begin + std::chrono::seconds(1);
+	while (Clock::now() < end) {
+		std::this_thread::sleep_until(std::min(next, end));
+		if (Clock::now() >= next) {
+			report(std::chrono::duration<double>(Clock::now() - begin).count(), options, last, false);
+			next += std::chrono::seconds(1);
+		}
+	}
+
+	stop = true;
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	std::cout << "final:\n";
+	report(std::chrono::duration<double>(Clock::now() - begin).count(), options, last, true);
+	return totals.disconnects || totals.connectFailures ? 2 : 0;
+}
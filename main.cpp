@@ -1,277 +1,242 @@
 #include "Socket.hpp"
+#include "Acceptor.hpp"
+#include "UdpChannel.hpp"
+#include "Room.hpp"
+#include "Scheduler.hpp"
+#include "Profiler.hpp"
+#include "Latency.hpp"
+#include "Capture.hpp"
+#include "Wakeup.hpp"
+#include "Debug.hpp"
 
 #include <atomic>
 #include <array>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <thread>
+#include <unordered_map>
+
+#include <csignal>
 
 #include "queue/readerwriterqueue.h"
 
 using moodycamel::ReaderWriterQueue;
 
-#ifdef DEBUG
-	#define DEBUG_PRINT(x) std::cout << std::this_thread::get_id() << ":" << __FILE__ << ":" << __LINE__ << ": " << x << std::endl
-	#define IF_DEBUG(x) x
-#else
-	#define DEBUG_PRINT(x)
-	#define IF_DEBUG(x)
-#endif
+// set by SIGUSR1, the lobby loop prints the profile
+static volatile std::sig_atomic_t profileRequested = 0;
 
-int main(void) {
+int main(int argc, char** argv) {
 	DEBUG_PRINT("IN DEBUG MODE");
 
-	int sockfd = Socket::initServer("3490");
+	// --backend=epoll (default), --backend=uring or --backend=threads (blocking, thread per socket)
+	// --listeners=N accept threads (default one per core)
+	// --workers=N threads ticking rooms (default one per core)
+	// --slow-tick-us=N log the breakdown of room ticks taking this long (default 5000)
+	// --record=PATH capture what every room handles, for replay.cpp
+	Socket::Backend backend = Socket::Backend::EPOLL;
+	unsigned listeners = 0;
+	unsigned workers = 0;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 12, "--listeners=") == 0) {
+			listeners = std::stoi(arg.substr(12));
+		} else if (arg.compare(0, 10, "--workers=") == 0) {
+			workers = std::stoi(arg.substr(10));
+		} else if (arg.compare(0, 15, "--slow-tick-us=") == 0) {
+			Profiler::setSlowTick(std::chrono::microseconds(std::stoi(arg.substr(15))));
+		} else if (arg.compare(0, 9, "--record=") == 0) {
+			if (!Capture::open(arg.substr(9))) {
+				return 1;
+			}
+		} else if (arg == "--backend=threads") {
+			backend = Socket::Backend::THREADS;
+		} else if (arg == "--backend=epoll") {
+			backend = Socket::Backend::EPOLL;
+		} else if (arg == "--backend=uring") {
+			backend = Socket::Backend::IO_URING;
+		} else {
+			std::cout << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+	Socket::useBackend(backend);
 
-	struct Client {
-		uint8_t id;
-		Socket sock;
+	// kill -USR1 prints tick phase percentiles and traffic without stopping anything
+	signal(SIGUSR1, [](int) { profileRequested = 1; });
 
-		enum Role { // TODO: reuse code from client
-			NONE,
-			ROBBER,
-			COP,
-		} role = Role::NONE;
+	// the lobby sleeps until a connection is accepted or a lobby client sends something
+	Wakeup lobbyWakeup;
 
-		Client(uint8_t id, int fd) : id(id), sock(fd) {}
-	};
+	Acceptor acceptor("3490", listeners);
+	acceptor.setListener(&lobbyWakeup);
+	UdpServer udp("3490"); // IN_GAME traffic, same port number
 
-	ReaderWriterQueue<int> newClients;
+	printf("server: waiting for connections on %zu listeners...\n", acceptor.listeners());
 
-	std::thread acceptThread([&sockfd, &newClients]() {
-		int accepted = 0;
+	// connected but not in a room yet, waiting for JOIN_ROOM
+	std::vector<std::unique_ptr<Client>> lobby;
 
-		while (accepted < 3) {
-			int fd = Socket::accept(sockfd);
-			if (fd == -1) {
-				continue;
-			}
-			newClients.enqueue(fd);
+	std::unordered_map<uint32_t, std::unique_ptr<Room>> rooms;
+	uint32_t openRoom = 0; // where JOIN_ROOM 0 goes while it has space, 0 if none
+	uint32_t nextRoomId = 1;
+
+	// rooms tick here, declared after rooms so the workers stop before any room goes away
+	Scheduler scheduler(workers);
+
+	auto createRoom = [&](uint32_t id) -> Room* {
+		Room* room = new Room(id, udp, scheduler);
+		rooms[id].reset(room);
+		DEBUG_PRINT("created room " << id << ", " << rooms.size() << " rooms");
+		return room;
+	};
 
-			accepted++;
+	// put client in the room a JOIN_ROOM for id asks for, nullptr (and client untouched) if it can't join.
+	// Only the lobby makes rooms, an id picks one somebody was already matched into, so a client
+	// can't have the server allocate rooms for made up ids
+	auto joinRoom = [&](uint32_t id, std::unique_ptr<Client>& client) -> Room* {
+		Room* room;
+		if (id != 0) {
+			auto it = rooms.find(id);
+			if (it == rooms.end()) {
+				return nullptr;
+			}
+			room = it->second.get();
+			return room->tryJoin(client) ? room : nullptr;
 		}
-		std::cout << "Done accepting clients" << std::endl;
-		close(sockfd);
-	});
-	acceptThread.detach();
 
-	// ------- game state --------
-	std::vector<std::unique_ptr<Client>> clients;
+		auto open = rooms.find(openRoom);
+		if (open != rooms.end() && open->second->tryJoin(client)) {
+			return open->second.get();
+		}
 
-	enum State {
-		STAGING,
-		IN_GAME,
-	} state = STAGING;
+		do {
+			id = nextRoomId++;
+		} while (id == 0 || rooms.count(id));
+		openRoom = id;
 
-	struct StagingState {
-		bool starting = false;
-		float startingTimer = 0.0f;
-		Client* robber = nullptr; // everyone else assumed to be cop
-		unsigned playerUnready = 0;
-	} stagingState;
+		room = createRoom(id);
+		return room->tryJoin(client) ? room : nullptr;
+	};
 
-	// clock timing logic from https://stackoverflow.com/a/20381816
-	typedef std::chrono::duration<int, std::ratio<1, 10>> frame_duration;
-	auto delta = frame_duration(1);
-	float dt = 1.0f / 10.0f;
+	// the lobby only routes, rooms tick on the scheduler. Past joins and disconnects it only
+	// closes empty rooms, prints the profile and flushes the capture, that can wait this long
+	auto housekeeping = std::chrono::milliseconds(100);
+	IF_DEBUG(auto lastStats = std::chrono::steady_clock::now());
 
-	std::thread gameLoop([&]() {
+	std::thread lobbyLoop([&]() {
 		while (true) {
 			auto start_time = std::chrono::steady_clock::now();
 
-			switch (state) {
-				case STAGING: {
-
-					// process newly accepted connections
-					int fd;
-					while (newClients.try_dequeue(fd)) {
-						uint8_t newId = clients.size();
-
-						std::vector<uint8_t> syncData;
-						syncData.push_back(newId);
-						for (auto& client : clients) {
-							client->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_PLAYER_CONNECT, {newId}));
-							syncData.push_back(client->id);
-							syncData.push_back(client->role);
-						};
-
-						clients.emplace_back(new Client(newId, fd));
-
-						clients.back()->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_PLAYER_SYNC, syncData));
+			// process newly accepted connections
+			int fd;
+			while (acceptor.tryTake(fd)) {
+				lobby.emplace_back(new Client(fd));
+				lobby.back()->sock.setListener(&lobbyWakeup); // anything it sent already is read below
+			}
 
-						stagingState.playerUnready += 1;
+			// route lobby clients to rooms
+			for (size_t i = 0; i < lobby.size();) {
+				Client& client = *lobby[i];
+				Room* joined = nullptr;
 
-						// TODO: tell new client about game settings / staging state
+				Packet* out;
+				while (!joined && client.sock.readQueue.try_dequeue(out)) {
+					if (!out) {
+						std::cout << "Bad packet from client" << std::endl;
+						continue;
 					}
 
-					for (auto& client : clients) {
-						if (!client->sock.isConnected()) {
-							continue;
-						}
-
-						// read pending messages from clients
-						Packet* out;
-						while (client->sock.readQueue.try_dequeue(out)) {
-							if (!out) {
-								std::cout << "Bad packet from client" << std::endl;
-								continue;
+					MessageLatency::Handling handling(out->stamp, out->payload.at(0)); // replies carry its recv stamp
+					switch (out->payload.at(0)) { // message type
+						case MessageType::JOIN_ROOM: {
+							uint32_t id = 0;
+							for (size_t b = 1; b < out->payload.size() && b <= 4; b++) {
+								id |= uint32_t(out->payload[b]) << (8 * (b - 1));
 							}
 
-							switch (out->payload.at(0)) { // message type
-								case MessageType::STAGING_VOTE_TO_START: {
-									if (stagingState.starting) {
-										break;
-									}
-
-									if (clients.size() < 2) {
-										break;
-									}
-
-									if (stagingState.playerUnready > 0) {
-										// TODO: error message saying not all players are ready
-										break;
-									}
-
-									stagingState.starting = true;
-									stagingState.startingTimer = 0.0f;
-									IF_DEBUG(stagingState.startingTimer = 3.0f);
-
-									std::cout << "Client voted to start the game" << std::endl;
-
-									// TODO: queue up message saying player voted to start the game
-									// or do it now?
-									for (auto& c : clients) {
-										c->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_VOTE_TO_START, {client->id}));
-									}
-
-									break;
-								}
-
-								case MessageType::STAGING_VETO_START: {
-									if (!stagingState.starting) {
-										break;
-									}
-
-									stagingState.starting = false;
-
-									std::cout << "Client vetoed the game start" << std::endl;
-
-									// TODO: queue up message start vetod by x message
-									// or do it now?
-									for (auto& c : clients) {
-										c->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_VETO_START, {client->id}));
-									}
-
-									break;
-								}
-
-								case MessageType::STAGING_ROLE_CHANGE: {
-									if (stagingState.starting) {
-										break;
-									}
-
-									DEBUG_PRINT("client " << (int)client->id << " wants role " << int(out->payload[1]));
-
-									if (out->payload[1] == Client::Role::ROBBER && stagingState.robber) { // can't be robber if someone else is
-										client->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_ROLE_CHANGE_REJECTION, {stagingState.robber->id}));
-										break;
-									}
-
-									if (client->role == Client::Role::NONE) { // client has never selected anything
-										stagingState.playerUnready -= 1;
-									}
-
-									// client is no longer robber
-									if (client->role == Client::Role::ROBBER && out->payload[1] != Client::Role::ROBBER) {
-										stagingState.robber = nullptr;
-									}
-
-									if (out->payload[1] == Client::Role::ROBBER) { // desires to be robber
-										stagingState.robber = client.get();
-									}
-
-									client->role = static_cast<Client::Role>(out->payload[1]);
-
-									// tell players of role change
-									for (auto& c : clients) {
-										c->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_ROLE_CHANGE, {client->id, out->payload[1]}));
-									}
-
-									break;
-								}
-
-								default: {
-									std::cout << "Unknown starting message type: " << (int)out->payload.at(0) << std::endl;
-									break;
-								}
+							// on success the room owns the client (and its queues) from here on
+							joined = joinRoom(id, lobby[i]);
+							if (!joined) {
+								client.sock.writeQueue.enqueue(Packet::pack(MessageType::JOIN_ROOM_REJECTION, {
+									uint8_t(id), uint8_t(id >> 8), uint8_t(id >> 16), uint8_t(id >> 24)
+								}));
 							}
-
-							delete out;
+							break;
 						}
-					}
 
-					if (stagingState.starting) {
-						stagingState.startingTimer += dt;
+						case MessageType::FRAMING_VARINT: {
+							// echo it back, frames after the echo use varint headers
+							client.sock.writeQueue.enqueue(Packet::pack(MessageType::FRAMING_VARINT));
+							client.varint = true;
+							break;
+						}
 
-						if (stagingState.startingTimer > 5.0f) {
-							std::cout << "Game starting. Leaving staging." << std::endl;
-							for (auto& c : clients) {
-								c->sock.writeQueue.enqueue(Packet::pack(MessageType::STAGING_START_GAME, { 200 }));
-							}
-							state = IN_GAME;
+						default: {
+							std::cout << "Unknown lobby message type: " << (int)out->payload.at(0) << std::endl;
+							break;
 						}
 					}
 
-					// write state updates
-
-					break;
+					out->release();
 				}
 
-				case IN_GAME: {
-					for (auto& client : clients) {
-						// read pending messages from clients
-						Packet* out;
-						while (client->sock.readQueue.try_dequeue(out)) {
-							if (!out) {
-								std::cout << "Bad packet from client" << std::endl;
-								continue;
-							}
-
-							switch (out->payload.at(0)) { // message type
-
-								default: {
-									std::cout << "Unknown game message type: " << (int)out->payload[0] << std::endl;
-									break;
-								}
-							}
+				if (!joined && client.sock.isConnected()) {
+					i++;
+					continue;
+				}
 
-							delete out;
-						}
-					}
+				// in a room (which reads whatever was queued after the join) or gone
+				lobby[i] = std::move(lobby.back());
+				lobby.pop_back();
+			}
 
-					// write state updates
-					for (auto& client : clients) {
-						Packet* delta = new Packet();
-						delta->payload.push_back('H');
-						delta->payload.push_back('E');
-						delta->payload.push_back('L');
-						delta->payload.push_back('L');
-						delta->payload.push_back('O');
-						delta->header = delta->payload.size();
-						client->sock.writeQueue.enqueue(delta);
-					}
+			for (auto it = rooms.begin(); it != rooms.end();) {
+				if (it->second->finished()) {
+					DEBUG_PRINT("room " << it->first << " is empty, closing it");
+					it = rooms.erase(it);
+				} else {
+					++it;
+				}
+			}
 
-					break;
+			IF_DEBUG(if (start_time - lastStats >= std::chrono::seconds(10)) {
+				lastStats = start_time;
+				Scheduler::Stats stats = scheduler.stats();
+				DEBUG_PRINT("room ticks: " << stats.ticks << ", late " << stats.lateTicks
+					<< ", mean lateness " << (stats.ticks ? stats.totalLatenessUs / stats.ticks : 0) << "us, max " << stats.maxLatenessUs << "us");
+				FixedStep::Stats steps = FixedStep::total();
+				DEBUG_PRINT("sim steps: " << steps.steps << ", snapshots " << steps.netSteps
+					<< ", missed " << steps.missed << ", overruns " << steps.overruns);
+				const Histogram& ticks = Profiler::phase(Profiler::TICK);
+				DEBUG_PRINT("room tick p50 " << ticks.percentile(0.5) / 1000 << "us, p99 " << ticks.percentile(0.99) / 1000
+					<< "us, max " << ticks.maximum() / 1000 << "us");
+			});
+
+			if (profileRequested) {
+				profileRequested = 0;
+				Profiler::report(std::cout);
+
+				const Histogram& wait = TrafficTotals::writeWait();
+				std::cout << "tcp traffic: ";
+				TrafficTotals::total().print(std::cout);
+				std::cout << "\nwrite queue wait p50 " << wait.percentile(0.5) / 1000 << "us, p99 " << wait.percentile(0.99) / 1000
+					<< "us, p99.9 " << wait.percentile(0.999) / 1000 << "us" << std::endl;
+				MessageLatency::report(std::cout);
+				for (auto& room : rooms) {
+					room.second->report(std::cout);
 				}
 			}
 
-			// sleep if necessary
-			std::this_thread::sleep_until(start_time + delta);
+			Capture::flush();
+			Profiler::record(Profiler::LOBBY, std::chrono::steady_clock::now() - start_time);
+
+			lobbyWakeup.waitFor(housekeeping);
 		}
 	});
 
-	gameLoop.join();
+	lobbyLoop.join();
 
 	return 0;
-}
\ No newline at end of file
+}
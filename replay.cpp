@@ -0,0 +1,274 @@
+// Feeds a capture recorded with the server's --record=PATH back through the room code as fast
+// as it will go: no sockets, no clock, no scheduler threads, each run stepping exactly as
+// many times as it did live. Reports runs and steps per second and the per-phase profile,
+// and hashes the game state and every frame the rooms wrote, so two builds can be checked
+// for doing the same thing with the same input.
+//
+//   g++ -std=c++11 -O2 replay.cpp -o replay -pthread
+//   ./replay capture.bin
+//
+// --repeat=N     replay N times, timing each and checking they all hash the same (default 1)
+// --expect=HEX   exit 1 unless the replay hash is HEX, e.g. from the other build
+// --verbose      keep the rooms' own logging, it's dropped by default
+
+#include "Capture.hpp"
+#include "Profiler.hpp"
+#include "Room.hpp"
+#include "Scheduler.hpp"
+#include "UdpChannel.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// FNV-1a, the same as Room::stateHash
+static void mix(uint64_t& hash, const void* data, size_t size) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+}
+
+struct Result {
+	uint64_t runs = 0;
+	uint64_t steps = 0;
+	uint64_t frames = 0; // fed in
+	uint64_t framesOut = 0;
+	uint64_t bytesOut = 0;
+	uint64_t stateHash = 14695981039346656037ull;
+	uint64_t outputHash = 14695981039346656037ull;
+	double seconds = 0.0;
+	bool diverged = false; // the rooms didn't do what the capture says they did live
+};
+
+class Replay {
+public:
+	Replay() : udp(UdpServer::Detached()), scheduler(Scheduler::Paused()) {}
+
+	Result run(const std::vector<Capture::Record>& records) {
+		Clock::time_point start = Clock::now();
+		for (const Capture::Record& record : records) {
+			switch (record.kind) {
+				case Capture::JOIN: {
+					join(record.room, record.client);
+					break;
+				}
+
+				case Capture::LEAVE: {
+					Client* client = find(record.room, record.client);
+					if (client) {
+						drain(record.room, *client);
+						client->sock.close(); // the room lets it go next run
+						clients.erase(std::make_pair(record.room, record.client));
+					}
+					break;
+				}
+
+				case Capture::FRAME: {
+					Client* client = find(record.room, record.client);
+					if (client) {
+						Packet* packet = Packet::acquire();
+						packet->payload = record.payload;
+						packet->header = packet->payload.size();
+						client->sock.readQueue.enqueue(packet);
+						result.frames++;
+					}
+					break;
+				}
+
+				case Capture::RUN: {
+					auto room = rooms.find(record.room);
+					if (room == rooms.end()) {
+						diverge("run of room " + std::to_string(record.room) + " before anyone joined it");
+						break;
+					}
+					room->second->replay(record.steps);
+					result.runs++;
+					result.steps += record.steps;
+
+					for (auto& client : clients) {
+						if (client.first.first == record.room) {
+							drain(record.room, *client.second);
+						}
+					}
+					break;
+				}
+			}
+		}
+		result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		// rooms in the order they were made, then what each client was sent
+		for (auto& room : created) {
+			uint64_t hash = room->stateHash();
+			uint32_t id = room->getId();
+			mix(result.stateHash, &id, sizeof id);
+			mix(result.stateHash, &hash, sizeof hash);
+		}
+		for (auto& client : clients) {
+			drain(client.first.first, *client.second);
+		}
+		for (auto& output : outputs) {
+			mix(result.outputHash, &output.first.first, sizeof output.first.first); // not the pair, it has padding
+			mix(result.outputHash, &output.first.second, sizeof output.first.second);
+			mix(result.outputHash, &output.second, sizeof output.second);
+		}
+		return result;
+	}
+
+private:
+	UdpServer udp;
+	Scheduler scheduler;
+	std::map<uint32_t, Room*> rooms; // by id, the newest room to have it
+	std::vector<std::unique_ptr<Room>> created; // every room, closed ones too
+	std::map<std::pair<uint32_t, uint8_t>, Client*> clients; // connected, owned by their room
+	std::map<std::pair<uint32_t, uint8_t>, uint64_t> outputs; // hash of everything written to each client
+	Result result;
+
+	void diverge(const std::string& why) {
+		if (!result.diverged) {
+			std::cerr << "replay diverged: " << why << std::endl;
+		}
+		result.diverged = true;
+	}
+
+	Client* find(uint32_t room, uint8_t id) {
+		auto it = clients.find(std::make_pair(room, id));
+		if (it == clients.end()) {
+			diverge("no client " + std::to_string(id) + " in room " + std::to_string(room));
+			return nullptr;
+		}
+		return it->second;
+	}
+
+	void join(uint32_t id, uint8_t clientId) {
+		std::unique_ptr<Client> client(new Client());
+		Client* joining = client.get();
+
+		// a room that emptied out is gone, live the lobby would have made a new one
+		auto room = rooms.find(id);
+		if (room == rooms.end() || !room->second->tryJoin(client)) {
+			created.emplace_back(new Room(id, udp, scheduler));
+			rooms[id] = created.back().get();
+			if (!rooms[id]->tryJoin(client)) {
+				diverge("room " + std::to_string(id) + " turned a client away");
+				return;
+			}
+		}
+
+		if (joining->id != clientId) {
+			diverge("room " + std::to_string(id) + " gave client " + std::to_string(clientId) + " id " + std::to_string(joining->id));
+		}
+		clients[std::make_pair(id, clientId)] = joining;
+		outputs[std::make_pair(id, clientId)] = 14695981039346656037ull;
+	}
+
+	// take everything the room wrote to client
+	void drain(uint32_t room, Client& client) {
+		uint64_t& hash = outputs[std::make_pair(room, client.id)];
+		Packet* packet;
+		while (client.sock.writeQueue.try_dequeue(packet)) {
+			if (!packet) {
+				continue;
+			}
+			mix(hash, packet->payload.data(), packet->payload.size());
+			result.framesOut++;
+			result.bytesOut += packet->payload.size();
+			packet->release();
+		}
+	}
+};
+
+int main(int argc, char** argv) {
+	std::string path;
+	unsigned repeat = 1;
+	std::string expect;
+	bool verbose = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 9, "--repeat=") == 0) {
+			repeat = std::max(1, std::stoi(arg.substr(9)));
+		} else if (arg.compare(0, 9, "--expect=") == 0) {
+			expect = arg.substr(9);
+		} else if (arg == "--verbose") {
+			verbose = true;
+		} else if (path.empty() && arg.compare(0, 2, "--") != 0) {
+			path = arg;
+		} else {
+			std::cout << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (path.empty()) {
+		std::cout << "usage: replay CAPTURE [--repeat=N] [--expect=HEX] [--verbose]" << std::endl;
+		return 1;
+	}
+
+	// read it all first so the file isn't part of the timing
+	std::vector<Capture::Record> records;
+	{
+		Capture::Reader reader;
+		if (!reader.open(path)) {
+			return 1;
+		}
+		Capture::Record record;
+		while (reader.next(record)) {
+			records.push_back(record);
+		}
+	}
+	std::cout << path << ": " << records.size() << " records" << std::endl;
+
+	Profiler::setSlowTick(std::chrono::hours(1)); // every tick here runs flat out, none are slow
+
+	std::ostringstream discard;
+	std::streambuf* console = std::cout.rdbuf();
+
+	uint64_t first = 0;
+	bool mismatch = false;
+	for (unsigned r = 0; r < repeat; r++) {
+		if (!verbose) {
+			std::cout.rdbuf(discard.rdbuf());
+		}
+		Result result = Replay().run(records);
+		std::cout.rdbuf(console);
+		discard.str("");
+
+		uint64_t hash = result.stateHash;
+		mix(hash, &result.outputHash, sizeof result.outputHash);
+		if (r == 0) {
+			first = hash;
+		} else if (hash != first) {
+			mismatch = true;
+		}
+
+		std::cout << std::fixed << std::setprecision(3)
+			<< "replay " << r + 1 << ": " << result.runs << " runs, " << result.steps << " steps, "
+			<< result.frames << " frames in, " << result.framesOut << " frames (" << result.bytesOut << "B) out in "
+			<< result.seconds * 1000 << "ms, " << std::setprecision(0) << result.runs / result.seconds << " runs/s, "
+			<< result.steps / result.seconds << " steps/s\n"
+			<< std::hex << std::setfill('0')
+			<< "  state " << std::setw(16) << result.stateHash << ", output " << std::setw(16) << result.outputHash
+			<< ", replay hash " << std::setw(16) << hash << std::dec << std::setfill(' ')
+			<< (result.diverged ? " (diverged from the capture)" : "") << std::endl;
+	}
+
+	Profiler::report(std::cout);
+
+	if (mismatch) {
+		std::cout << "replays hashed differently, something depends on more than the capture" << std::endl;
+		return 1;
+	}
+	if (!expect.empty() && std::stoull(expect, nullptr, 16) != first) {
+		std::cout << "replay hash doesn't match " << expect << std::endl;
+		return 1;
+	}
+	return 0;
+}